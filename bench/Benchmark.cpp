@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "DumpPlayer.hpp"
+#include "SynthEngine.hpp"
+
+using namespace AyMidi;
+
+namespace {
+
+    constexpr int blockSize = 256;
+    // Blocks queued per skip call, their events must fit the engine queue.
+    constexpr int skipBlocks = 64;
+
+    struct Options {
+        double seconds = 10.0;
+        int chips = 1;
+        Quality quality = QUALITY_NORMAL;
+        bool skip = false;
+        std::vector<std::string> dumps;
+    };
+
+    struct Scenario {
+        const char* name;
+        void (*setup)(SynthEngine& engine);
+        void (*block)(SynthEngine& engine, long index, long blocksPerSecond);
+    };
+
+    // Offset in the next process or skip call of the events sent.
+    uint32_t sendOffset = 0;
+
+    void send(SynthEngine& engine, uint8_t status, uint8_t data1, uint8_t data2) {
+        const uint8_t message[3] = {status, data1, data2};
+        engine.midiSend(message, sendOffset);
+    }
+
+    const uint8_t chords[4][3] = {
+        {60, 64, 67},
+        {57, 60, 64},
+        {53, 57, 60},
+        {55, 59, 62}
+    };
+
+    // Changes chord twice per second.
+    void playChords(SynthEngine& engine, long index, long blocksPerSecond) {
+        const long blocksPerChord = std::max(blocksPerSecond / 2, 1L);
+        if (index % blocksPerChord != 0) {
+            return;
+        }
+        const long chord = index / blocksPerChord;
+        if (chord > 0) {
+            for (auto key : chords[(chord - 1) % 4]) {
+                send(engine, 0x80, key, 0);
+            }
+        }
+        for (auto key : chords[chord % 4]) {
+            send(engine, 0x90, key, 100);
+        }
+    }
+
+    void setupNone(SynthEngine&) {
+    }
+
+    void blockNone(SynthEngine&, long, long) {
+    }
+
+    void blockChords(SynthEngine& engine, long index, long blocksPerSecond) {
+        playChords(engine, index, blocksPerSecond);
+    }
+
+    void setupArpeggio(SynthEngine& engine) {
+        send(engine, 0xB0, MIDI_CTL_MONO_MODE_ON, 1);
+        send(engine, 0xB0, MIDI_CTL_AY_ARPEGGIO_RATE, 124);
+    }
+
+    void setupAutomation(SynthEngine& engine) {
+        send(engine, 0xC0, 2, 0);
+    }
+
+    void blockAutomation(SynthEngine& engine, long index, long blocksPerSecond) {
+        playChords(engine, index, blocksPerSecond);
+        const uint8_t value = index % 128;
+        send(engine, 0xB0, MIDI_CTL_SC7_VIBRATO_RATE, value);
+        send(engine, 0xB0, MIDI_CTL_SC8_VIBRATO_DEPTH, 127 - value);
+        send(engine, 0xB0, MIDI_CTL_MSB_PAN, value);
+        send(engine, 0xB0, MIDI_CTL_MSB_MAIN_VOLUME, 64 + value / 2);
+        send(engine, 0xB0, MIDI_CTL_AY_SQUARE_DETUNE, value);
+        send(engine, 0xB0, MIDI_CTL_AY_BUZZER_DETUNE, 127 - value);
+        send(engine, 0xE0, value, 0x40);
+    }
+
+    // Chords with the buzzer restarted at the note pitch.
+    void setupTimers(SynthEngine& engine) {
+        send(engine, 0xC0, 2, 0);
+        send(engine, 0xB0, MIDI_CTL_AY_TIMER_EFFECT, 32);
+    }
+
+    const Scenario scenarios[] = {
+        {"idle", setupNone, blockNone},
+        {"chords", setupNone, blockChords},
+        {"arpeggio", setupArpeggio, blockChords},
+        {"automation", setupAutomation, blockAutomation},
+        {"timers", setupTimers, blockChords}
+    };
+
+    float sink = 0.0f;
+
+    void run(const Scenario& scenario, const Options& options, int sampleRate, int updateRate) {
+        SynthEngine engine(sampleRate, 2000000);
+        engine.setGain(1.0f);
+        engine.setChips(options.chips);
+        engine.setQuality(options.quality);
+        engine.setUpdateRate(updateRate);
+        scenario.setup(engine);
+
+        std::vector<float> left(blockSize);
+        std::vector<float> right(blockSize);
+        const long frames = options.seconds * sampleRate;
+        const long blocks = (frames + blockSize - 1) / blockSize;
+        const long group = options.skip ? skipBlocks : 1;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (long index = 0; index < blocks; index++) {
+            sendOffset = index % group * blockSize;
+            scenario.block(engine, index, sampleRate / blockSize);
+            if (!options.skip) {
+                engine.process(left.data(), right.data(), blockSize);
+                sink += left[0] + right[blockSize - 1];
+            } else if (index % group == group - 1 || index == blocks - 1) {
+                engine.skip(sendOffset + blockSize);
+            }
+        }
+        sendOffset = 0;
+        const auto end = std::chrono::steady_clock::now();
+
+        const double elapsed = std::chrono::duration<double>(end - start).count();
+        const double samples = (double)blocks * blockSize;
+        const double ticks = samples / sampleRate * updateRate;
+        std::printf("%-12s %8d %6d %12.1f %14.0f %10.1f\n",
+                scenario.name, sampleRate, updateRate,
+                elapsed * 1e9 / samples, ticks / elapsed, samples / sampleRate / elapsed);
+    }
+
+    // Plays a register dump through the chips alone, restarting it when it
+    // ends.
+    bool runDump(const std::string& path, const Options& options, int sampleRate) {
+        DumpPlayer player(sampleRate);
+        player.setQuality(options.quality);
+        if (!player.load(path)) {
+            std::fprintf(stderr, "%s: %s\n", path.c_str(), player.getError().c_str());
+            return false;
+        }
+
+        std::vector<float> left(blockSize);
+        std::vector<float> right(blockSize);
+        const long frames = options.seconds * sampleRate;
+        const long blocks = (frames + blockSize - 1) / blockSize;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (long index = 0; index < blocks; index++) {
+            if (player.isFinished()) {
+                player.load(path);
+            }
+            player.process(left.data(), right.data(), blockSize);
+            sink += left[0] + right[blockSize - 1];
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        const double elapsed = std::chrono::duration<double>(end - start).count();
+        const double samples = (double)blocks * blockSize;
+        const size_t slash = path.find_last_of('/');
+        const std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+        std::printf("%-12.12s %8d %6s %12.1f %14s %10.1f\n",
+                name.c_str(), sampleRate, "-",
+                elapsed * 1e9 / samples, "-", samples / sampleRate / elapsed);
+        return true;
+    }
+
+    void usage(const char* name) {
+        std::fprintf(stderr, "Usage: %s [-s seconds] [-c chips] [-q draft|normal|mastering] [-k] [-d dump] [scenario...]\n", name);
+        std::exit(1);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    std::vector<const Scenario*> selected;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            options.seconds = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            options.chips = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-k") == 0) {
+            options.skip = true;
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            options.dumps.push_back(argv[++i]);
+        } else if (std::strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            const char* quality = argv[++i];
+            if (std::strcmp(quality, "draft") == 0) {
+                options.quality = QUALITY_DRAFT;
+            } else if (std::strcmp(quality, "normal") == 0) {
+                options.quality = QUALITY_NORMAL;
+            } else if (std::strcmp(quality, "mastering") == 0) {
+                options.quality = QUALITY_MASTERING;
+            } else {
+                usage(argv[0]);
+            }
+        } else {
+            const Scenario* found = nullptr;
+            for (auto& scenario : scenarios) {
+                if (std::strcmp(argv[i], scenario.name) == 0) {
+                    found = &scenario;
+                }
+            }
+            if (found == nullptr) {
+                usage(argv[0]);
+            }
+            selected.push_back(found);
+        }
+    }
+    if (selected.empty() && options.dumps.empty()) {
+        for (auto& scenario : scenarios) {
+            selected.push_back(&scenario);
+        }
+    }
+    if (options.seconds <= 0 || options.chips < 1 || options.chips > SynthEngine::maxChips) {
+        usage(argv[0]);
+    }
+
+    std::printf("%-12s %8s %6s %12s %14s %10s\n", "scenario", "rate", "update", "ns/sample", "ticks/s", "realtime");
+    for (auto scenario : selected) {
+        for (int sampleRate : {44100, 96000, 192000}) {
+            for (int updateRate : {50, 300}) {
+                run(*scenario, options, sampleRate, updateRate);
+            }
+        }
+    }
+    for (const auto& dump : options.dumps) {
+        for (int sampleRate : {44100, 96000, 192000}) {
+            if (!runDump(dump, options, sampleRate)) {
+                return 1;
+            }
+        }
+    }
+    return sink == 12345.0f ? 1 : 0;
+}
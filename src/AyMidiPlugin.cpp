@@ -1,5 +1,10 @@
+#include <atomic>
 #include <cstdint>
+#include <cstring>
+#include <string>
 #include "DistrhoPlugin.hpp"
+#include "LoadMeter.hpp"
+#include "RegisterCapture.hpp"
 #include "SynthEngine.hpp"
 
 START_NAMESPACE_DISTRHO
@@ -19,22 +24,43 @@ class AyMidiPlugin : public Plugin {
         EMUL,
         UPDATERATE,
         BASICCHANNEL,
+        CHIPS,
+        QUALITY,
+        DRUMCHANNEL,
+        LOAD,
+        PEAKLOAD,
+        TICKS,
+        REGISTERWRITES,
+        ACTIVENOTES,
+        VOICESTEALS,
+        DROPPEDSETTINGS,
         NUM_PARAMETERS
     };
 
+    enum StateIds {
+        CAPTURE,
+        DRUMS,
+        NUM_STATES
+    };
+
     public:
         /**
           Plugin class constructor.
           */
         AyMidiPlugin()
-            : Plugin(NUM_PARAMETERS, 0, 0), // 0 parameters, 0 programs and 0 states
+            : Plugin(NUM_PARAMETERS, 0, NUM_STATES),
             pGain(1.0),
             pClockRate(2e6),
-            pEmul(AyMidi::YM2149)
+            pEmul(AyMidi::YM2149),
+            pUpdateRate(50),
+            pBasicChannel(1),
+            pChips(1),
+            pQuality(AyMidi::QUALITY_NORMAL),
+            pDrumChannel(10),
+            loadMeter(getSampleRate())
         {
-            soundGenerator = std::make_shared<AyMidi::SoundGenerator>(getSampleRate(), pClockRate);
-            synthEngine = std::make_shared<AyMidi::SynthEngine>(soundGenerator);
-            soundGenerator->setGain(pGain);
+            synthEngine = std::make_unique<AyMidi::SynthEngine>(getSampleRate(), pClockRate);
+            synthEngine->setGain(pGain);
         }
 
     protected:
@@ -138,6 +164,114 @@ class AyMidiPlugin : public Plugin {
                     parameter.ranges.max = 16;
                     parameter.ranges.def = 1;
                     break;
+                case CHIPS:
+                    parameter.hints     |= kParameterIsInteger;
+                    parameter.name       = "Chips";
+                    parameter.symbol     = "Chips";
+                    parameter.ranges.min = 1;
+                    parameter.ranges.max = AyMidi::SynthEngine::maxChips;
+                    parameter.ranges.def = 1;
+                    break;
+                case QUALITY:
+                    parameter.hints     |= kParameterIsInteger;
+                    parameter.name       = "Quality";
+                    parameter.symbol     = "Quality";
+                    parameter.description = "Draft oversamples 2x and aliases high tones, noise and envelopes. Normal and mastering oversample 8x.";
+                    parameter.ranges.min = 0;
+                    parameter.ranges.max = 2;
+                    parameter.ranges.def = 1;
+                    parameter.enumValues.count = 3;
+                    parameter.enumValues.restrictedMode = true;
+                    {
+                        ParameterEnumerationValue* const enumValues = new ParameterEnumerationValue[3];
+                        enumValues[0].value = AyMidi::QUALITY_DRAFT;
+                        enumValues[0].label = "Draft";
+                        enumValues[1].value = AyMidi::QUALITY_NORMAL;
+                        enumValues[1].label = "Normal";
+                        enumValues[2].value = AyMidi::QUALITY_MASTERING;
+                        enumValues[2].label = "Mastering";
+                        parameter.enumValues.values = enumValues;
+                    }
+                    break;
+                case DRUMCHANNEL:
+                    parameter.hints     |= kParameterIsInteger;
+                    parameter.name       = "Drum Channel";
+                    parameter.symbol     = "DCHANNEL";
+                    parameter.ranges.min = 0;
+                    parameter.ranges.max = 16;
+                    parameter.ranges.def = 10;
+                    break;
+                case LOAD:
+                    parameter.hints      = kParameterIsOutput;
+                    parameter.name       = "DSP Load";
+                    parameter.symbol     = "Load";
+                    parameter.unit       = "%";
+                    parameter.ranges.max = 100.0f;
+                    break;
+                case PEAKLOAD:
+                    parameter.hints      = kParameterIsOutput;
+                    parameter.name       = "Peak DSP Load";
+                    parameter.symbol     = "PeakLoad";
+                    parameter.unit       = "%";
+                    parameter.ranges.max = 100.0f;
+                    break;
+                case TICKS:
+                    parameter.hints      = kParameterIsOutput;
+                    parameter.name       = "Ticks";
+                    parameter.symbol     = "Ticks";
+                    parameter.unit       = "/s";
+                    parameter.ranges.max = 300.0f;
+                    break;
+                case REGISTERWRITES:
+                    parameter.hints      = kParameterIsOutput;
+                    parameter.name       = "Register Writes";
+                    parameter.symbol     = "RegWrites";
+                    parameter.unit       = "/s";
+                    parameter.ranges.max = 1e6f;
+                    break;
+                case ACTIVENOTES:
+                    parameter.hints      = kParameterIsOutput | kParameterIsInteger;
+                    parameter.name       = "Active Notes";
+                    parameter.symbol     = "Notes";
+                    parameter.ranges.max = 256.0f;
+                    break;
+                case VOICESTEALS:
+                    parameter.hints      = kParameterIsOutput;
+                    parameter.name       = "Voice Steals";
+                    parameter.symbol     = "Steals";
+                    parameter.unit       = "/s";
+                    parameter.ranges.max = 1000.0f;
+                    break;
+                case DROPPEDSETTINGS:
+                    parameter.hints      = kParameterIsOutput | kParameterIsInteger;
+                    parameter.name       = "Dropped Settings";
+                    parameter.symbol     = "Dropped";
+                    parameter.ranges.max = 1e6f;
+                    break;
+            }
+        }
+
+        /**
+          Initialize a state.
+          The capture state holds the path of a register dump being recorded, ending
+          in .ym or .vgm. An empty value stops the capture.
+          The drums state holds a directory with the digidrum samples as <key>.wav
+          files. An empty value selects the built-in kit.
+          */
+        void initState(uint32_t index, State& state) override
+        {
+            switch (index) {
+                case CAPTURE:
+                    state.key          = "capture";
+                    state.defaultValue = "";
+                    state.label        = "Register Capture";
+                    state.hints        = kStateIsFilenamePath;
+                    break;
+                case DRUMS:
+                    state.key          = "drums";
+                    state.defaultValue = "";
+                    state.label        = "Drum Kit";
+                    break;
             }
         }
 
@@ -160,6 +294,26 @@ class AyMidiPlugin : public Plugin {
                     return pUpdateRate;
                 case BASICCHANNEL:
                     return pBasicChannel;
+                case CHIPS:
+                    return pChips;
+                case QUALITY:
+                    return pQuality;
+                case DRUMCHANNEL:
+                    return pDrumChannel;
+                case LOAD:
+                    return loadMeter.getMean();
+                case PEAKLOAD:
+                    return loadMeter.getPeak();
+                case TICKS:
+                    return oTicks.load(std::memory_order_relaxed);
+                case REGISTERWRITES:
+                    return oRegisterWrites.load(std::memory_order_relaxed);
+                case ACTIVENOTES:
+                    return oActiveNotes.load(std::memory_order_relaxed);
+                case VOICESTEALS:
+                    return oVoiceSteals.load(std::memory_order_relaxed);
+                case DROPPEDSETTINGS:
+                    return oDroppedSettings.load(std::memory_order_relaxed);
             }
 
             return 0.0f;
@@ -167,36 +321,128 @@ class AyMidiPlugin : public Plugin {
 
         /**
           Change a parameter value.
+          Hosts may call this from other threads than the audio one, so engine
+          settings are queued and applied by run() at the start of the next
+          block.
           */
         void setParameterValue(uint32_t index, float value) override
         {
             switch (index) {
                 case GAIN:
                     pGain = value;
-                    soundGenerator->setGain(pGain);
+                    postSetting(AyMidi::SETTING_GAIN, pGain);
                     break;
                 case CLOCKRATE:
                     pClockRate = value;
-                    soundGenerator->setClockRate(pClockRate);
+                    postSetting(AyMidi::SETTING_CLOCK_RATE, pClockRate);
                     break;
                 case EMUL:
                     pEmul = value;
-                    soundGenerator->setEmul(pEmul == 1.0f ? AyMidi::YM2149 : AyMidi::AY8910);
+                    postSetting(AyMidi::SETTING_EMUL, pEmul);
                     break;
                 case UPDATERATE:
                     pUpdateRate = value;
-                    synthEngine->setUpdateRate((int)pUpdateRate);
+                    postSetting(AyMidi::SETTING_UPDATE_RATE, pUpdateRate);
                     break;
                 case BASICCHANNEL:
                     pBasicChannel = value;
-                    synthEngine->setBasicChannel((int)pBasicChannel - 1);
+                    postSetting(AyMidi::SETTING_BASIC_CHANNEL, pBasicChannel - 1);
+                    break;
+                case CHIPS:
+                    pChips = value;
+                    postSetting(AyMidi::SETTING_CHIPS, pChips);
+                    break;
+                case QUALITY:
+                    pQuality = value;
+                    postSetting(AyMidi::SETTING_QUALITY, pQuality);
+                    break;
+                case DRUMCHANNEL:
+                    pDrumChannel = value;
+                    postSetting(AyMidi::SETTING_DRUM_CHANNEL, pDrumChannel - 1);
                     break;
             }
         }
 
+        // DPF doesn't tell at which frame a host changed a parameter, so the
+        // change applies at the start of the next block. Changes that find
+        // the queue full are counted by the engine and reported as an output.
+        void postSetting(AyMidi::Setting setting, float value)
+        {
+            synthEngine->postSetting(setting, value);
+        }
+
+        /**
+          Change a state value.
+          */
+        void setState(const char* key, const char* value) override
+        {
+            if (std::strcmp(key, "drums") == 0) {
+                setDrums(value);
+                return;
+            }
+            if (std::strcmp(key, "capture") != 0) {
+                return;
+            }
+            const std::string path = value;
+            // The log outlives the capture, so the audio thread may still be
+            // pushing into it while the file is closed.
+            synthEngine->setRegisterLog(nullptr);
+            if (!registerCapture.stop()) {
+                d_stderr("Register capture failed: %s", registerCapture.getError().c_str());
+            }
+            if (path.empty()) {
+                return;
+            }
+            const size_t dot = path.find_last_of('.');
+            const std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+            if (extension != ".ym" && extension != ".vgm") {
+                d_stderr("Register capture needs a .ym or .vgm file: %s", value);
+                return;
+            }
+            const auto format = extension == ".ym" ? AyMidi::RegisterWriter::YM : AyMidi::RegisterWriter::VGM;
+            if (!registerCapture.start(path, format, pClockRate, pUpdateRate,
+                        pEmul == 1.0f ? AyMidi::YM2149 : AyMidi::AY8910)) {
+                d_stderr("Register capture failed: %s", registerCapture.getError().c_str());
+                return;
+            }
+            synthEngine->setRegisterLog(registerCapture.getLog());
+        }
+
+        /**
+          Load a drum kit here and hand it to the engine. The kits it replaces
+          are kept until the audio thread has picked up the current one.
+          */
+        void setDrums(const char* value)
+        {
+            std::unique_ptr<AyMidi::DrumKit> kit;
+            if (value[0] != '\0') {
+                kit = std::make_unique<AyMidi::DrumKit>();
+                if (!kit->load(value)) {
+                    d_stderr("Drum kit failed: %s", kit->getError().c_str());
+                    return;
+                }
+            }
+            synthEngine->setDrumKit(kit.get());
+            if (drumKit) {
+                retiredDrumKits.push_back(std::move(drumKit));
+            }
+            drumKit = std::move(kit);
+            if (synthEngine->getPickedDrumKit() == drumKit.get()) {
+                retiredDrumKits.clear();
+            }
+        }
+
         /* ----------------------------------------------------------------------------------------
          * Audio/MIDI Processing */
 
+        /**
+          The audio thread is stopped, so no retired kit is in use anymore.
+          */
+        void deactivate() override
+        {
+            retiredDrumKits.clear();
+        }
+
         /**
           Run/process function for plugins without MIDI input.
           */
@@ -205,27 +451,42 @@ class AyMidiPlugin : public Plugin {
                 const MidiEvent* midiEvents,
                 uint32_t midiEventCount) override
         {
-            float* outL = outputs[0];
-            float* outR = outputs[1];
-
-            uint32_t currentFrame = 0;
-            for (int i = 0; i < midiEventCount; i++) {
+            loadMeter.begin();
+            for (uint32_t i = 0; i < midiEventCount; i++) {
                 const MidiEvent& me = midiEvents[i];
-                if (me.frame > currentFrame) {
-                    const uint32_t size = me.frame - currentFrame;
-                    synthEngine->process(outL, outR, size);
-                    currentFrame = me.frame;
-                    outL += size;
-                    outR += size;
-                }
-                synthEngine->midiSend(me.data);
+                synthEngine->midiSend(me.data, me.frame);
+            }
+            synthEngine->process(outputs[0], outputs[1], frames);
+            if (loadMeter.end(frames)) {
+                updateMeters();
             }
-            synthEngine->process(outL, outR, frames - currentFrame);
+        }
+
+        /**
+          Refresh the engine counters once per load window. Ticks, register
+          writes and voice steals are given per second.
+          */
+        void updateMeters()
+        {
+            const double window = loadMeter.getWindow();
+            const uint32_t ticks = synthEngine->getTicks();
+            const uint64_t registerWrites = synthEngine->getRegisterWrites();
+            const uint64_t voiceSteals = synthEngine->getVoiceSteals();
+            oTicks.store((ticks - lastTicks) / window, std::memory_order_relaxed);
+            oRegisterWrites.store((registerWrites - lastRegisterWrites) / window, std::memory_order_relaxed);
+            oActiveNotes.store(synthEngine->getActiveNotes(), std::memory_order_relaxed);
+            oVoiceSteals.store((voiceSteals - lastVoiceSteals) / window, std::memory_order_relaxed);
+            oDroppedSettings.store(synthEngine->getDroppedSettings(), std::memory_order_relaxed);
+            lastTicks = ticks;
+            lastRegisterWrites = registerWrites;
+            lastVoiceSteals = voiceSteals;
         }
 
     private:
-        std::shared_ptr<AyMidi::SoundGenerator> soundGenerator;
-        std::shared_ptr<AyMidi::SynthEngine> synthEngine;
+        AyMidi::RegisterCapture registerCapture;
+        std::unique_ptr<AyMidi::SynthEngine> synthEngine;
+        std::unique_ptr<AyMidi::DrumKit> drumKit;
+        std::vector<std::unique_ptr<AyMidi::DrumKit>> retiredDrumKits;
 
         // Parameters
         float pGain;
@@ -233,6 +494,20 @@ class AyMidiPlugin : public Plugin {
         float pEmul;
         float pUpdateRate;
         float pBasicChannel;
+        float pChips;
+        float pQuality;
+        float pDrumChannel;
+
+        // Outputs
+        AyMidi::LoadMeter loadMeter;
+        std::atomic<float> oTicks{0.0f};
+        std::atomic<float> oRegisterWrites{0.0f};
+        std::atomic<float> oActiveNotes{0.0f};
+        std::atomic<float> oVoiceSteals{0.0f};
+        std::atomic<float> oDroppedSettings{0.0f};
+        uint32_t lastTicks = 0;
+        uint64_t lastRegisterWrites = 0;
+        uint64_t lastVoiceSteals = 0;
 
         DISTRHO_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AyMidiPlugin)
 };
@@ -1,75 +1,143 @@
 #include <algorithm>
+#include <iterator>
 #include <math.h>
 #include "Channel.hpp"
-#include <DistrhoUtils.hpp>
 
 namespace AyMidi {
 
-    Channel::Channel(std::shared_ptr<VoiceProcessor> vp, int index) :
+    namespace {
+
+        float makeFloat(const int value, const int bits, const float min, const float max) {
+            return (max - min) * value / ((1 << bits) - 1) + min;
+        }
+
+        int makeInt(const int value, const int bits, const int min, const int max) {
+            return std::round(makeFloat(value, bits, min, max));
+        }
+
+        // Controller values mapped to parameter ranges once, handlers only
+        // look them up.
+        struct ControlTables {
+            float unit[128];
+            float detune[128];
+            float vibratoRate[128];
+            int range32[128];
+            int arpeggioPeriod[128];
+
+            ControlTables() {
+                for (int i = 0; i < 128; i++) {
+                    unit[i] = makeFloat(i, 7, 0.0f, 1.0f);
+                    detune[i] = makeFloat(i, 7, -16.0f, 16.0f);
+                    vibratoRate[i] = makeFloat(i, 7, 0.0f, 10.0f);
+                    range32[i] = makeInt(i, 7, 0, 32);
+                    arpeggioPeriod[i] = (64 - makeInt(i, 7, 0, 64)) - (i < 64 ? 65 : 0);
+                    if (arpeggioPeriod[i] == 32) {
+                        arpeggioPeriod[i] = 0;
+                    }
+                }
+            }
+        };
+
+        const ControlTables tables;
+    }
+
+    Channel::Channel(VoiceProcessor& vp, NotePool& pool, int index) :
         index(index),
-        vp(vp)
+        vp(vp),
+        pool(pool),
+        noteCount(0),
+        currentKey(0),
+        arpeggioCounter(0),
+        params()
     {
+        std::fill(std::begin(notesByKey), std::end(notesByKey), nullptr);
         msgReset();
     }
 
-    std::shared_ptr<Note> Channel::findNote(const int key) const {
-        auto it = std::find_if(notes.begin(), notes.end(), [key](std::shared_ptr<Note> note) { return note->key == key; });
-        if (it == notes.end()) {
+    Note* Channel::findNote(const int key) const {
+        if (key < 0 || key >= maxNotes) {
             return nullptr;
         }
-        return *it;
+        return notesByKey[key];
     }
 
-    std::shared_ptr<Note> Channel::nextArpeggioNote() {
-        if (notes.empty()) {
+    Note* Channel::nextArpeggioNote() {
+        if (noteCount == 0) {
             return nullptr;
         }
-        auto it = std::upper_bound(notes.begin(), notes.end(), currentNote, [arpeggioPeriod = params.arpeggioPeriod](std::shared_ptr<Note> a, std::shared_ptr<Note> b) {
-            return arpeggioPeriod > 0 ? a->key < b->key : a->key > b->key;
+        auto it = std::upper_bound(notes, notes + noteCount, currentKey, [arpeggioPeriod = params.arpeggioPeriod](int key, const Note* note) {
+            return arpeggioPeriod > 0 ? key < note->key : key > note->key;
         });
-        if (it == notes.end()) {
+        if (it == notes + noteCount) {
             return notes[0];
         }
         return *it;
     }
 
     void Channel::purgeNotes() {
-        notes.erase(std::remove_if(notes.begin(), notes.end(), [](std::shared_ptr<Note> note) { return !note->isValid(); }), notes.end());
+        int count = 0;
+        for (int i = 0; i < noteCount; i++) {
+            Note* note = notes[i];
+            if (note->isValid()) {
+                notes[count++] = note;
+            } else {
+                vp.unregisterNote(note);
+                notesByKey[note->key] = nullptr;
+                pool.release(note);
+            }
+        }
+        noteCount = count;
     }
 
-    void Channel::msgNoteOn(const int key, const int velocity) {
-        if (findNote(key) != nullptr) {
-            return;
+    void Channel::sortNotes() {
+        std::sort(notes, notes + noteCount, [arpeggioPeriod = params.arpeggioPeriod](const Note* a, const Note* b) {
+            return arpeggioPeriod > 0 ? a->key < b->key : a->key > b->key;
+        });
+    }
+
+    Note* Channel::msgNoteOn(const int key, const int velocity) {
+        if (key < 0 || key >= maxNotes || notesByKey[key] != nullptr) {
+            return nullptr;
+        }
+        Note* note = pool.acquire(&params, key, velocity, index);
+        if (note == nullptr) {
+            return nullptr;
         }
-        auto note = std::make_shared<Note>(&params, key, velocity, index);
+        // Notes joining others keep the running vibrato.
+        if (noteCount == 0) {
+            lfo.reset();
+        }
+        Note** position = notes + noteCount;
         if (params.arpeggioPeriod != 0) {
-            notes.insert(std::upper_bound(notes.begin(), notes.end(), note, [arpeggioPeriod = params.arpeggioPeriod](std::shared_ptr<Note> a, std::shared_ptr<Note> b) {
-                return arpeggioPeriod > 0 ? a->key < b->key : a->key > b->key;
-            }), note);
-        } else {
-            notes.push_back(note);
+            position = std::upper_bound(notes, notes + noteCount, key, [arpeggioPeriod = params.arpeggioPeriod](int key, const Note* note) {
+                return arpeggioPeriod > 0 ? key < note->key : key > note->key;
+            });
+            std::move_backward(position, notes + noteCount, notes + noteCount + 1);
         }
-        vp->registerNote(note);
-        currentNote = note;
+        *position = note;
+        noteCount++;
+        notesByKey[key] = note;
+        vp.registerNote(note);
+        currentKey = key;
+        return note;
     }
 
     void Channel::msgNoteOff(const int key, const int velocity) {
-        std::for_each(notes.begin(), notes.end(), [key](std::shared_ptr<Note> note) {
-            if (note->key == key) {
-                note->release();
-            }
-        });
+        Note* note = findNote(key);
+        if (note != nullptr) {
+            note->release();
+        }
     }
 
     void Channel::msgKeyPressure(const int key, const int pressure) {
-        auto note = findNote(key);
+        Note* note = findNote(key);
         if (note != nullptr) {
             note->setPressure(pressure);
         }
     }
 
     void Channel::msgPressure(int pressure) {
-        params.pressure = pressure / 127.0f;
+        params.pressure = tables.unit[pressure];
     }
 
     void Channel::msgProgramChange(int program) {
@@ -81,18 +149,18 @@ namespace AyMidi {
     }
 
     void Channel::msgVolume(int volume) {
-        params.volume = volume / 127.0f;
+        params.volume = tables.unit[volume];
     }
 
     void Channel::msgAllSoundsOff() {
-        for (auto note : notes) {
-            note->drop();
+        for (int i = 0; i < noteCount; i++) {
+            notes[i]->drop();
         }
     }
 
     void Channel::msgAllNotesOff() {
-        for (auto note : notes) {
-            note->release();
+        for (int i = 0; i < noteCount; i++) {
+            notes[i]->release();
         }
     }
 
@@ -101,23 +169,23 @@ namespace AyMidi {
     }
 
     void Channel::msgModWheel(int value) {
-        params.modWheel = makeFloat(value, 7, 0.0f, 1.0f);
+        params.modWheel = tables.unit[value];
     }
 
     void Channel::msgPan(int value) {
-        params.pan = makeFloat(value, 7, 0.0f, 1.0f);
+        params.pan = tables.unit[value];
     }
 
     void Channel::msgNoisePeriod(int period) {
-        params.noisePeriod = makeInt(period, 7, 0, 32);
+        params.noisePeriod = tables.range32[period];
     }
 
     void Channel::msgBuzzerDetune(int detune) {
-        params.buzzerDetune = makeFloat(detune, 7, -16.0f, 16.0f);
+        params.buzzerDetune = tables.detune[detune];
     }
 
     void Channel::msgSquareDetune(int detune) {
-        params.squareDetune = makeFloat(detune, 7, -16.0f, 16.0f);
+        params.squareDetune = tables.detune[detune];
     }
 
     void Channel::msgAttackPitch(int pitch) {
@@ -137,7 +205,7 @@ namespace AyMidi {
     }
 
     void Channel::msgSustain(int sustain) {
-        params.envelope.sustain = sustain / 127.0f;
+        params.envelope.sustain = tables.unit[sustain];
     }
 
     void Channel::msgRelease(int release) {
@@ -146,27 +214,35 @@ namespace AyMidi {
 
     void Channel::msgArpeggioRate(int rate) {
         auto prevArpeggioPeriod = params.arpeggioPeriod;
-        params.arpeggioPeriod = (64 - makeInt(rate, 7, 0, 64)) - (rate < 64 ? 65 : 0);
-        if (params.arpeggioPeriod == 32) {
-            params.arpeggioPeriod = 0;
-        }
+        params.arpeggioPeriod = tables.arpeggioPeriod[rate];
         if (params.arpeggioPeriod != 0 && (params.arpeggioPeriod * prevArpeggioPeriod) <= 0) {
-            std::sort(notes.begin(), notes.end(), [arpeggioPeriod = params.arpeggioPeriod](std::shared_ptr<Note> a, std::shared_ptr<Note> b) {
-                return arpeggioPeriod > 0 ? a->key < b->key : a->key > b->key;
-            });
+            sortNotes();
         }
     }
 
+    void Channel::msgTimerEffect(int effect) {
+        params.timerEffect = effect / 32;
+    }
+
+    void Channel::msgTimerDetune(int detune) {
+        params.timerDetune = tables.detune[detune];
+    }
+
     void Channel::msgVibratoRate(int rate) {
-        params.vibratoRate = makeFloat(rate, 7, 0.0f, 10.0f);
+        params.vibratoRate = tables.vibratoRate[rate];
     }
 
     void Channel::msgVibratoDepth(int depth) {
-        params.vibratoDepth = makeFloat(depth, 7, 0.0f, 1.0f);
+        params.vibratoDepth = tables.unit[depth];
     }
 
     void Channel::msgVibratoDelay(int delay) {
-        params.vibratoDelay = makeInt(delay, 7, 0, 32);
+        params.vibratoDelay = tables.range32[delay];
+    }
+
+    void Channel::msgVibratoWaveform(int waveform) {
+        params.vibratoWaveform = waveform / 32;
+        lfo.setWaveform((LfoWaveform)params.vibratoWaveform);
     }
 
     void Channel::msgPortamento(int portamento) {
@@ -174,7 +250,7 @@ namespace AyMidi {
     }
 
     void Channel::msgPortamentoTime(int time) {
-        params.portamentoTime = makeInt(time, 7, 0, 32);
+        params.portamentoTime = tables.range32[time];
     }
 
     void Channel::msgPortamentoControl(int control) {
@@ -190,10 +266,13 @@ namespace AyMidi {
         msgVibratoRate(0);
         msgVibratoDepth(0);
         msgVibratoDelay(0);
+        msgVibratoWaveform(0);
         msgNoisePeriod(0);
         msgBuzzerDetune(64);
         msgSquareDetune(64);
         msgArpeggioRate(64);
+        msgTimerEffect(0);
+        msgTimerDetune(64);
         msgAttackPitch(0);
         msgAttack(0);
         msgHold(0);
@@ -211,36 +290,70 @@ namespace AyMidi {
         msgPortamentoControl(0);
     }
 
-    int Channel::makeInt(const int value, const int bits, const int min, const int max) const {
-        return std::round(makeFloat(value, bits, min, max));
-    }
-
-    float Channel::makeFloat(const int value, const int bits, const float min, const float max) const {
-        return (max - min) * value / ((1 << bits) - 1) + min;
-    }
-
     void Channel::updateArpeggio(int updateRate) {
         int arpeggioPeriod = std::round((float)params.arpeggioPeriod * updateRate / 100.0f);
         arpeggioCounter++;
         if (arpeggioCounter >= abs(arpeggioPeriod)) {
             arpeggioCounter = 0;
-            auto nextNote = nextArpeggioNote();
+            Note* nextNote = nextArpeggioNote();
             if (nextNote != nullptr) {
-                vp->registerNote(nextNote);
-                currentNote = nextNote;
+                vp.registerNote(nextNote);
+                currentKey = nextNote->key;
             }
         }
     }
 
     void Channel::update(int updateRate) {
-        for (auto note: notes) {
-            if (note->isValid()) {
-                note->updateEnvelope();
+        params.vibrato = 0.0f;
+        if (params.vibratoDepth > 0 && params.vibratoRate > 0) {
+            params.vibrato = lfo.update(params.vibratoRate, updateRate);
+        }
+        for (int i = 0; i < noteCount; i++) {
+            if (notes[i]->isValid()) {
+                notes[i]->updateEnvelope();
             }
         }
         purgeNotes();
-        if (vp->getMonoMode() && params.arpeggioPeriod != 0) {
+        if (noteCount == 0) {
+            // The engine stops updating the channel until the next note.
+            arpeggioCounter = 0;
+            params.vibrato = 0.0f;
+            return;
+        }
+        if (vp.getMonoMode() && params.arpeggioPeriod != 0) {
             updateArpeggio(updateRate);
         }
     }
+
+    bool Channel::isActive() const {
+        return noteCount > 0;
+    }
+
+    ChannelData* Channel::getParams() {
+        return &params;
+    }
+
+    void Channel::save(State& state) const {
+        for (int i = 0; i < maxNotes; i++) {
+            state.notes[i] = i < noteCount ? pool.indexOf(notes[i]) : -1;
+            state.notesByKey[i] = pool.indexOf(notesByKey[i]);
+        }
+        state.noteCount = noteCount;
+        state.currentKey = currentKey;
+        state.arpeggioCounter = arpeggioCounter;
+        state.params = params;
+        state.lfo = lfo;
+    }
+
+    void Channel::restore(const State& state) {
+        for (int i = 0; i < maxNotes; i++) {
+            notes[i] = pool.getNote(state.notes[i]);
+            notesByKey[i] = pool.getNote(state.notesByKey[i]);
+        }
+        noteCount = state.noteCount;
+        currentKey = state.currentKey;
+        arpeggioCounter = state.arpeggioCounter;
+        params = state.params;
+        lfo = state.lfo;
+    }
 }
@@ -1,9 +1,9 @@
 #pragma once
 
-#include <memory>
-#include <vector>
 #include "types.hpp"
+#include "Lfo.hpp"
 #include "Note.hpp"
+#include "NotePool.hpp"
 #include "VoiceProcessor.hpp"
 
 namespace AyMidi {
@@ -12,22 +12,39 @@ namespace AyMidi {
 
         private:
             int index;
-            std::shared_ptr<VoiceProcessor> vp;
-            std::vector<std::shared_ptr<Note>> notes;
-            std::shared_ptr<Note> currentNote;
+            constexpr static int maxNotes = 128;
+
+            VoiceProcessor& vp;
+            NotePool& pool;
+            // Live notes, sorted by key in arpeggio mode, by arrival otherwise.
+            Note* notes[maxNotes];
+            Note* notesByKey[maxNotes];
+            int noteCount;
+            int currentKey;
             int arpeggioCounter;
             ChannelData params;
+            Lfo lfo;
 
-            int makeInt(const int value, const int bits, const int min, const int max) const;
-            float makeFloat(const int value, const int bits, const float min, const float max) const;
             void updateArpeggio(int updateRate);
+            void sortNotes();
 
         public:
-            Channel(std::shared_ptr<VoiceProcessor> vp, int index);
-            std::shared_ptr<Note> findNote(const int key) const;
+            // Notes are stored as pool indices.
+            struct State {
+                int notes[maxNotes];
+                int notesByKey[maxNotes];
+                int noteCount;
+                int currentKey;
+                int arpeggioCounter;
+                ChannelData params;
+                Lfo lfo;
+            };
+
+            Channel(VoiceProcessor& vp, NotePool& pool, int index);
+            Note* findNote(const int key) const;
             void purgeNotes();
-            std::shared_ptr<Note> nextArpeggioNote();
-            void msgNoteOn(int key, int velocity);
+            Note* nextArpeggioNote();
+            Note* msgNoteOn(int key, int velocity);
             void msgNoteOff(int key, int velocity);
             void msgKeyPressure(const int note, const int pressure);
             void msgPressure(int pressure);
@@ -46,9 +63,12 @@ namespace AyMidi {
             void msgSustain(int sustain);
             void msgRelease(int release);
             void msgArpeggioRate(int rate);
+            void msgTimerEffect(int effect);
+            void msgTimerDetune(int detune);
             void msgVibratoRate(int rate);
             void msgVibratoDepth(int depth);
             void msgVibratoDelay(int delay);
+            void msgVibratoWaveform(int waveform);
             void msgPortamento(int portamento);
             void msgPortamentoTime(int time);
             void msgPortamentoControl(int control);
@@ -57,5 +77,9 @@ namespace AyMidi {
             void msgReset();
             void msgResetCC();
             void update(int updateRate);
+            bool isActive() const;
+            ChannelData* getParams();
+            void save(State& state) const;
+            void restore(const State& state);
     };
 }
@@ -0,0 +1,58 @@
+#include "CommandQueue.hpp"
+
+namespace AyMidi {
+
+    static int roundCapacity(int capacity) {
+        int size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    CommandQueue::CommandQueue(int capacity) :
+        slots(roundCapacity(capacity)),
+        mask(slots.size() - 1)
+    {
+        for (uint32_t i = 0; i < slots.size(); i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    int CommandQueue::getCapacity() const {
+        return slots.size();
+    }
+
+    // A slot is free for a position when its sequence equals it, and still
+    // holds the command of the previous lap when it is behind.
+    bool CommandQueue::push(const Command& command) {
+        uint32_t position = head.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[position & mask];
+            const int32_t lag = (int32_t)(slot.sequence.load(std::memory_order_acquire) - position);
+            if (lag < 0) {
+                return false;
+            }
+            if (lag > 0) {
+                position = head.load(std::memory_order_relaxed);
+            } else if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                slot.command = command;
+                slot.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    // Stops at a slot that is reserved but not written yet, so commands
+    // come out in the order their positions were reserved.
+    bool CommandQueue::pop(Command& command) {
+        Slot& slot = slots[tail & mask];
+        if (slot.sequence.load(std::memory_order_acquire) != tail + 1) {
+            return false;
+        }
+        command = slot.command;
+        slot.sequence.store(tail + mask + 1, std::memory_order_release);
+        tail++;
+        return true;
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace AyMidi {
+
+    // A change for the audio thread to make at a sample offset of the next
+    // block.
+    struct Command {
+        uint32_t offset;
+        int id;
+        float value;
+    };
+
+    // Multiple producer, single consumer queue of commands. Producers get
+    // false back when the queue is full, nobody ever blocks. Each slot holds
+    // a sequence number telling which position may use it next, producers
+    // reserve positions from the head with a compare and swap.
+    class CommandQueue {
+
+        private:
+            struct Slot {
+                std::atomic<uint32_t> sequence;
+                Command command;
+            };
+
+            std::vector<Slot> slots;
+            uint32_t mask;
+            std::atomic<uint32_t> head{0};
+            uint32_t tail = 0;
+
+        public:
+            CommandQueue(int capacity = 256);
+            int getCapacity() const;
+            bool push(const Command& command);
+            bool pop(Command& command);
+    };
+}
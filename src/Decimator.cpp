@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "Decimator.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define AYMIDI_DECIMATOR_X86
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define AYMIDI_DECIMATOR_NEON
+#endif
+
+namespace AyMidi {
+
+    extern "C" {
+#include "ayumi.h"
+    }
+
+    // First half of the symmetric decimation filter in ayumi.c (taps 1 to 96).
+    static const double halfFilter[FIR_SIZE / 2] = {
+        -0.0000046183113992051936, -0.00001117761640887225, -0.000018610264502005432, -0.000025134586135631012,
+        -0.000028494281690666197, -0.000026396828793275159, -0.000017094212558802156, 0.0,
+        0.000023798193576966866, 0.000051281160242202183, 0.00007762197826243427, 0.000096759426664120416,
+        0.00010240229300393402, 0.000089344614218077106, 0.000054875700118949183, 0.0,
+        -0.000069839082210680165, -0.0001447966132360757, -0.00021158452917708308, -0.00025535069106550544,
+        -0.00026228714374322104, -0.00022258805927027799, -0.00013323230495695704, 0.0,
+        0.00016182578767055206, 0.00032846175385096581, 0.00047045611576184863, 0.00055713851457530944,
+        0.00056212565121518726, 0.00046901918553962478, 0.00027624866838952986, 0.0,
+        -0.00032564179486838622, -0.00065182310286710388, -0.00092127787309319298, -0.0010772534348943575,
+        -0.0010737727700273478, -0.00088556645390392634, -0.00051581896090765534, 0.0,
+        0.00059548767193795277, 0.0011803558710661009, 0.0016527320270369871, 0.0019152679330965555,
+        0.0018927324805381538, 0.0015481870327877937, 0.00089470695834941306, 0.0,
+        -0.0010178225878206125, -0.0020037400552054292, -0.0027874356824117317, -0.003210329988021943,
+        -0.0031540624117984395, -0.0025657163651900345, -0.0014750752642111449, 0.0,
+        0.0016624165446378462, 0.0032591192839069179, 0.0045165685815867747, 0.0051838984346123896,
+        0.0050774264697459933, 0.0041192521414141585, 0.0023628575417966491, 0.0,
+        -0.0026543507866759182, -0.0051990251084333425, -0.0072020238234656924, -0.0082672928192007358,
+        -0.0081033739572956287, -0.006583111539570221, -0.0037839040415292386, 0.0,
+        0.0042781252851152507, 0.0084176358598320178, 0.01172566057463055, 0.013550476647788672,
+        0.013388189369997496, 0.010979501242341259, 0.006381274941685413, 0.0,
+        -0.007421229604153888, -0.01486456304340213, -0.021143584622178104, -0.02504275058758609,
+        -0.025473530942547201, -0.021627310017882196, -0.013104323383225543, 0.0,
+        0.017065133989980476, 0.036978919264451952, 0.05823318062093958, 0.079072012081405949,
+        0.097675998716952317, 0.11236045936950932, 0.12176343577287731, 0.125
+    };
+
+    // Kernels compute size outputs. Output i is the dot product of the filter
+    // with the taps samples starting at x + i * factor.
+
+    static double dotScalar(const double* x, const double* h, int taps) {
+        double sum0 = 0.0;
+        double sum1 = 0.0;
+        double sum2 = 0.0;
+        double sum3 = 0.0;
+        for (int i = 0; i < taps; i += 4) {
+            sum0 += x[i] * h[i];
+            sum1 += x[i + 1] * h[i + 1];
+            sum2 += x[i + 2] * h[i + 2];
+            sum3 += x[i + 3] * h[i + 3];
+        }
+        return (sum0 + sum1) + (sum2 + sum3);
+    }
+
+    static void decimateScalar(const double* x, const double* h, int taps, int factor, double* output, int size) {
+        for (int i = 0; i < size; i++) {
+            output[i] = dotScalar(x + i * factor, h, taps);
+        }
+    }
+
+#if defined(AYMIDI_DECIMATOR_X86)
+    __attribute__((target("sse2")))
+    static void decimateSse2(const double* x, const double* h, int taps, int factor, double* output, int size) {
+        int i = 0;
+        for (; i + 2 <= size; i += 2) {
+            const double* x0 = x + i * factor;
+            const double* x1 = x0 + factor;
+            __m128d sum0 = _mm_setzero_pd();
+            __m128d sum1 = _mm_setzero_pd();
+            for (int j = 0; j < taps; j += 2) {
+                const __m128d c = _mm_loadu_pd(h + j);
+                sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(x0 + j), c));
+                sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(x1 + j), c));
+            }
+            _mm_storeu_pd(output + i, _mm_add_pd(_mm_unpacklo_pd(sum0, sum1), _mm_unpackhi_pd(sum0, sum1)));
+        }
+        for (; i < size; i++) {
+            output[i] = dotScalar(x + i * factor, h, taps);
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    static void decimateAvx2(const double* x, const double* h, int taps, int factor, double* output, int size) {
+        int i = 0;
+        for (; i + 4 <= size; i += 4) {
+            const double* x0 = x + i * factor;
+            const double* x1 = x0 + factor;
+            const double* x2 = x1 + factor;
+            const double* x3 = x2 + factor;
+            __m256d sum0 = _mm256_setzero_pd();
+            __m256d sum1 = _mm256_setzero_pd();
+            __m256d sum2 = _mm256_setzero_pd();
+            __m256d sum3 = _mm256_setzero_pd();
+            for (int j = 0; j < taps; j += 4) {
+                const __m256d c = _mm256_loadu_pd(h + j);
+                sum0 = _mm256_fmadd_pd(_mm256_loadu_pd(x0 + j), c, sum0);
+                sum1 = _mm256_fmadd_pd(_mm256_loadu_pd(x1 + j), c, sum1);
+                sum2 = _mm256_fmadd_pd(_mm256_loadu_pd(x2 + j), c, sum2);
+                sum3 = _mm256_fmadd_pd(_mm256_loadu_pd(x3 + j), c, sum3);
+            }
+            const __m256d sum01 = _mm256_hadd_pd(sum0, sum1);
+            const __m256d sum23 = _mm256_hadd_pd(sum2, sum3);
+            _mm256_storeu_pd(output + i, _mm256_add_pd(
+                        _mm256_permute2f128_pd(sum01, sum23, 0x20),
+                        _mm256_permute2f128_pd(sum01, sum23, 0x31)));
+        }
+        for (; i < size; i++) {
+            output[i] = dotScalar(x + i * factor, h, taps);
+        }
+    }
+#elif defined(AYMIDI_DECIMATOR_NEON)
+    static void decimateNeon(const double* x, const double* h, int taps, int factor, double* output, int size) {
+        int i = 0;
+        for (; i + 2 <= size; i += 2) {
+            const double* x0 = x + i * factor;
+            const double* x1 = x0 + factor;
+            float64x2_t sum0 = vdupq_n_f64(0.0);
+            float64x2_t sum1 = vdupq_n_f64(0.0);
+            for (int j = 0; j < taps; j += 2) {
+                const float64x2_t c = vld1q_f64(h + j);
+                sum0 = vfmaq_f64(sum0, vld1q_f64(x0 + j), c);
+                sum1 = vfmaq_f64(sum1, vld1q_f64(x1 + j), c);
+            }
+            vst1q_f64(output + i, vpaddq_f64(sum0, sum1));
+        }
+        for (; i < size; i++) {
+            output[i] = dotScalar(x + i * factor, h, taps);
+        }
+    }
+#endif
+
+    Decimator::Kernel Decimator::selectKernel() {
+#if defined(AYMIDI_DECIMATOR_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return decimateAvx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return decimateSse2;
+        }
+#elif defined(AYMIDI_DECIMATOR_NEON)
+        return decimateNeon;
+#endif
+        return decimateScalar;
+    }
+
+    static double besselI0(double x) {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; term > sum * 1e-12; k++) {
+            term *= (x / (2 * k)) * (x / (2 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    // Kaiser windowed sinc. The cutoff is relative to the output sample rate.
+    static std::vector<double> designFilter(int taps, int factor, double cutoff, double beta) {
+        std::vector<double> h(taps);
+        const double fc = cutoff / factor;
+        const double center = (taps - 1) / 2.0;
+        double sum = 0.0;
+        for (int i = 0; i < taps; i++) {
+            const double t = i - center;
+            const double r = t / center;
+            const double sinc = t == 0.0 ? 2.0 * fc : std::sin(2.0 * M_PI * fc * t) / (M_PI * t);
+            h[i] = sinc * besselI0(beta * std::sqrt(1.0 - r * r)) / besselI0(beta);
+            sum += h[i];
+        }
+        for (auto& c : h) {
+            c /= sum;
+        }
+        return h;
+    }
+
+    // The window is stored oldest sample first. The normal tier is ayumi's
+    // own filter, whose newest sample has a null coefficient, which keeps
+    // the size a multiple of the vector width.
+    static std::vector<double> ayumiFilter() {
+        std::vector<double> h(FIR_SIZE);
+        for (int i = 0; i < FIR_SIZE - 1; i++) {
+            int tap = i + 1 <= FIR_SIZE / 2 ? i + 1 : FIR_SIZE - (i + 1);
+            h[i] = halfFilter[tap - 1];
+        }
+        h[FIR_SIZE - 1] = 0.0;
+        return h;
+    }
+
+    const Decimator::Filter* Decimator::getFilter(Quality quality) {
+        static_assert(designs[QUALITY_NORMAL].taps == FIR_SIZE && designs[QUALITY_NORMAL].factor == DECIMATE_FACTOR,
+            "The normal quality must use the ayumi filter");
+        constexpr const Design& draft = designs[QUALITY_DRAFT];
+        constexpr const Design& mastering = designs[QUALITY_MASTERING];
+        static const Filter filters[] = {
+            {draft.factor, designFilter(draft.taps, draft.factor, 0.42, 6.0)},
+            {DECIMATE_FACTOR, ayumiFilter()},
+            {mastering.factor, designFilter(mastering.taps, mastering.factor, 0.45, 9.0)}
+        };
+        return &filters[quality];
+    }
+
+    Decimator::Decimator() :
+        filter(getFilter(quality)),
+        history(filter->coefficients.size() - filter->factor),
+        kernel(selectKernel())
+    {
+        size_t size = 0;
+        for (auto quality : {QUALITY_DRAFT, QUALITY_NORMAL, QUALITY_MASTERING}) {
+            const Filter* f = getFilter(quality);
+            size = std::max(size, f->coefficients.size() - f->factor + maxBlockSize * f->factor);
+        }
+        buffer.resize(size);
+        reset();
+    }
+
+    void Decimator::setQuality(Quality quality) {
+        this->quality = quality;
+        filter = getFilter(quality);
+        history = filter->coefficients.size() - filter->factor;
+        reset();
+    }
+
+    Quality Decimator::getQuality() const {
+        return quality;
+    }
+
+    int Decimator::getFactor() const {
+        return filter->factor;
+    }
+
+    double* Decimator::getInput() {
+        return &buffer[history];
+    }
+
+    void Decimator::process(double* output, int size) {
+        kernel(buffer.data(), filter->coefficients.data(), filter->coefficients.size(), filter->factor, output, size);
+        std::memmove(buffer.data(), &buffer[size * filter->factor], history * sizeof(double));
+    }
+
+    void Decimator::reset() {
+        std::fill(buffer.begin(), buffer.end(), 0.0);
+    }
+
+    void Decimator::fill(double value) {
+        std::fill(buffer.begin(), buffer.end(), value);
+    }
+
+    // Takes the history of a decimator of the same quality that was fed
+    // the same input, in place of processing it again.
+    void Decimator::follow(const Decimator& other) {
+        std::copy(other.buffer.begin(), other.buffer.begin() + history, buffer.begin());
+    }
+
+    void Decimator::save(State& state) const {
+        state.quality = quality;
+        std::copy(buffer.begin(), buffer.begin() + history, state.history);
+    }
+
+    void Decimator::restore(const State& state) {
+        if (state.quality != quality) {
+            setQuality(state.quality);
+        }
+        std::copy(state.history, state.history + history, buffer.begin());
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+namespace AyMidi {
+
+    enum Quality {
+        QUALITY_DRAFT,
+        QUALITY_NORMAL,
+        QUALITY_MASTERING
+    };
+
+    class Decimator {
+
+        private:
+            typedef void (*Kernel)(const double* x, const double* h, int taps, int factor, double* output, int size);
+
+            struct Filter {
+                int factor;
+                std::vector<double> coefficients;
+            };
+
+            struct Design {
+                int taps;
+                int factor;
+            };
+
+            // Tap count and oversampling factor of the filter of each
+            // quality. Tap counts must be multiples of 4 for the vector
+            // kernels.
+            constexpr static Design designs[] = {{48, 2}, {192, 8}, {512, 8}};
+
+            std::vector<double> buffer;
+            Quality quality = QUALITY_NORMAL;
+            const Filter* filter;
+            int history;
+            Kernel kernel;
+
+            static Kernel selectKernel();
+            static const Filter* getFilter(Quality quality);
+
+        public:
+            constexpr static int maxBlockSize = 256;
+            // Longest input history kept between blocks.
+            constexpr static int maxHistory = std::max({
+                designs[QUALITY_DRAFT].taps - designs[QUALITY_DRAFT].factor,
+                designs[QUALITY_NORMAL].taps - designs[QUALITY_NORMAL].factor,
+                designs[QUALITY_MASTERING].taps - designs[QUALITY_MASTERING].factor
+            });
+
+            struct State {
+                Quality quality;
+                double history[maxHistory];
+            };
+
+            Decimator();
+            void setQuality(Quality quality);
+            Quality getQuality() const;
+            int getFactor() const;
+            double* getInput();
+            void process(double* output, int size);
+            void reset();
+            void fill(double value);
+            void follow(const Decimator& other);
+            void save(State& state) const;
+            void restore(const State& state);
+    };
+}
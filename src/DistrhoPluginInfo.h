@@ -11,6 +11,7 @@ START_NAMESPACE_DISTRHO
 #define DISTRHO_PLUGIN_NUM_OUTPUTS   2
 #define DISTRHO_PLUGIN_WANT_MIDI_INPUT  1
 #define DISTRHO_PLUGIN_WANT_MIDI_OUTPUT 0
+#define DISTRHO_PLUGIN_WANT_STATE       1
 #define DISTRHO_PLUGIN_CLAP_FEATURES      "instrument", "synthesizer"
 #define DISTRHO_PLUGIN_LV2_CATEGORY       "lv2:InstrumentPlugin"
 #define DISTRHO_PLUGIN_VST3_CATEGORIES    "Instrument|Synth"
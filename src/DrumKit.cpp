@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include "DrumKit.hpp"
+
+extern "C" double AY_dac_table[];
+
+namespace AyMidi {
+
+    static uint32_t readLittleEndian(const uint8_t* data, int bytes) {
+        uint32_t value = 0;
+        for (int i = bytes - 1; i >= 0; i--) {
+            value = value << 8 | data[i];
+        }
+        return value;
+    }
+
+    // Nearest chip level to a sample from -1 to 1 on the logarithmic DAC.
+    static uint8_t toLevel(float sample) {
+        const double amplitude = (sample + 1.0) / 2.0;
+        int best = 0;
+        for (int level = 1; level < 16; level++) {
+            if (std::fabs(AY_dac_table[level] - amplitude) < std::fabs(AY_dac_table[best] - amplitude)) {
+                best = level;
+            }
+        }
+        return best;
+    }
+
+    static uint32_t nextRandom(uint32_t& seed) {
+        seed = seed * 1664525 + 1013904223;
+        return seed >> 8;
+    }
+
+    static float noise(uint32_t& seed) {
+        return nextRandom(seed) / (float)(1 << 23) - 1.0f;
+    }
+
+    constexpr static double pi = 3.14159265358979323846;
+
+    // Sine swept down from start to end Hz, decaying in the given seconds.
+    static std::vector<float> makeTom(float start, float end, float seconds, float noiseMix) {
+        const int rate = DrumKit::defaultRate;
+        std::vector<float> samples(seconds * rate);
+        uint32_t seed = 1;
+        double phase = 0.0;
+        for (size_t i = 0; i < samples.size(); i++) {
+            const float t = (float)i / rate;
+            const float frequency = end + (start - end) * std::exp(-t * 20.0f);
+            phase += 2.0 * pi * frequency / rate;
+            const float decay = std::exp(-t * 5.0f / seconds);
+            samples[i] = decay * ((1.0f - noiseMix) * std::sin(phase) + noiseMix * noise(seed) * std::exp(-t * 40.0f));
+        }
+        return samples;
+    }
+
+    // Noise decaying in the given seconds, differentiated for a brighter
+    // sound.
+    static std::vector<float> makeNoise(float seconds, float bright, uint32_t seed) {
+        const int rate = DrumKit::defaultRate;
+        std::vector<float> samples(seconds * rate);
+        float last = 0.0f;
+        for (size_t i = 0; i < samples.size(); i++) {
+            const float t = (float)i / rate;
+            const float value = noise(seed);
+            samples[i] = std::exp(-t * 5.0f / seconds) * (value - bright * last) / (1.0f + bright);
+            last = value;
+        }
+        return samples;
+    }
+
+    static uint32_t nextId() {
+        static std::atomic<uint32_t> id{0};
+        return ++id;
+    }
+
+    DrumKit::DrumKit() :
+        id(nextId())
+    {
+    }
+
+    // General MIDI percussion keys.
+    void DrumKit::buildDefault() {
+        id = nextId();
+        arena.clear();
+        std::fill(std::begin(drums), std::end(drums), Drum());
+        struct Sound {
+            int key;
+            std::vector<float> samples;
+        };
+        std::vector<Sound> sounds;
+        const auto kick = makeTom(160.0f, 45.0f, 0.3f, 0.1f);
+        sounds.push_back({35, kick});
+        sounds.push_back({36, kick});
+        auto snare = makeTom(220.0f, 180.0f, 0.2f, 0.7f);
+        const auto rattle = makeNoise(0.2f, 0.5f, 2);
+        for (size_t i = 0; i < snare.size(); i++) {
+            snare[i] = 0.5f * snare[i] + 0.5f * rattle[i];
+        }
+        sounds.push_back({38, snare});
+        sounds.push_back({40, snare});
+        auto clap = makeNoise(0.25f, 0.3f, 3);
+        for (size_t i = 0; i < clap.size(); i++) {
+            const int burst = i * 100 / DrumKit::defaultRate;
+            if (burst < 3 && i * 100 % DrumKit::defaultRate > DrumKit::defaultRate / 2) {
+                clap[i] = 0.0f;
+            }
+        }
+        sounds.push_back({39, clap});
+        const auto closedHat = makeNoise(0.06f, 1.0f, 4);
+        sounds.push_back({42, closedHat});
+        sounds.push_back({44, closedHat});
+        sounds.push_back({46, makeNoise(0.35f, 1.0f, 5)});
+        const float toms[6] = {90.0f, 110.0f, 130.0f, 155.0f, 185.0f, 220.0f};
+        const int tomKeys[6] = {41, 43, 45, 47, 48, 50};
+        for (int i = 0; i < 6; i++) {
+            sounds.push_back({tomKeys[i], makeTom(toms[i] * 1.5f, toms[i], 0.35f, 0.2f)});
+        }
+        const auto crash = makeNoise(1.0f, 0.8f, 6);
+        sounds.push_back({49, crash});
+        sounds.push_back({57, crash});
+
+        size_t total = 0;
+        for (const auto& sound : sounds) {
+            total += sound.samples.size();
+        }
+        arena.reserve(total);
+        for (const auto& sound : sounds) {
+            addSample(sound.key, sound.samples.data(), sound.samples.size(), defaultRate);
+        }
+    }
+
+    // Loads <key>.wav files from the directory, missing keys stay silent.
+    bool DrumKit::load(const std::string& directory) {
+        id = nextId();
+        arena.clear();
+        std::fill(std::begin(drums), std::end(drums), Drum());
+        std::vector<std::vector<float>> samples(keys);
+        std::vector<int> rates(keys, 0);
+        size_t total = 0;
+        for (int key = 0; key < keys; key++) {
+            const std::string path = directory + "/" + std::to_string(key) + ".wav";
+            if (!std::ifstream(path)) {
+                continue;
+            }
+            if (!loadWav(path, samples[key], rates[key])) {
+                error = path + ": " + error;
+                return false;
+            }
+            total += samples[key].size();
+        }
+        if (total == 0) {
+            error = directory + ": no samples";
+            return false;
+        }
+        arena.reserve(total);
+        for (int key = 0; key < keys; key++) {
+            addSample(key, samples[key].data(), samples[key].size(), rates[key]);
+        }
+        return true;
+    }
+
+    // Samples are normalized to use the whole level range.
+    void DrumKit::addSample(int key, const float* samples, size_t count, int rate) {
+        if (key < 0 || key >= keys || count == 0 || rate <= 0) {
+            return;
+        }
+        float peak = 0.0f;
+        for (size_t i = 0; i < count; i++) {
+            peak = std::max(peak, std::fabs(samples[i]));
+        }
+        const float scale = peak > 0.0f ? 1.0f / peak : 1.0f;
+        id = nextId();
+        drums[key].offset = arena.size();
+        drums[key].length = count;
+        drums[key].rate = rate;
+        for (size_t i = 0; i < count; i++) {
+            arena.push_back(toLevel(samples[i] * scale));
+        }
+    }
+
+    // PCM or float WAV files, channels are mixed down.
+    bool DrumKit::loadWav(const std::string& path, std::vector<float>& samples, int& rate) {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (data.size() < 12 || std::memcmp(&data[0], "RIFF", 4) != 0 || std::memcmp(&data[8], "WAVE", 4) != 0) {
+            error = "not a WAV file";
+            return false;
+        }
+        int format = 0;
+        int channels = 0;
+        int bits = 0;
+        rate = 0;
+        for (size_t position = 12; position + 8 <= data.size();) {
+            const uint8_t* chunk = &data[position];
+            const size_t size = std::min<size_t>(readLittleEndian(chunk + 4, 4), data.size() - position - 8);
+            if (std::memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+                format = readLittleEndian(chunk + 8, 2);
+                channels = readLittleEndian(chunk + 10, 2);
+                rate = readLittleEndian(chunk + 12, 4);
+                bits = readLittleEndian(chunk + 22, 2);
+                if (format == 0xFFFE && size >= 26) {
+                    format = readLittleEndian(chunk + 32, 2);
+                }
+            } else if (std::memcmp(chunk, "data", 4) == 0) {
+                const bool pcm = format == 1 && (bits == 8 || bits == 16 || bits == 24 || bits == 32);
+                if ((!pcm && !(format == 3 && bits == 32)) || channels == 0 || rate == 0) {
+                    error = "unsupported WAV format";
+                    return false;
+                }
+                const int bytes = bits / 8;
+                const size_t frames = size / (bytes * channels);
+                samples.assign(frames, 0.0f);
+                for (size_t i = 0; i < frames; i++) {
+                    float sum = 0.0f;
+                    for (int channel = 0; channel < channels; channel++) {
+                        const uint8_t* sample = chunk + 8 + (i * channels + channel) * bytes;
+                        const uint32_t value = readLittleEndian(sample, bytes);
+                        if (format == 3) {
+                            float real;
+                            std::memcpy(&real, &value, sizeof(real));
+                            sum += real;
+                        } else if (bits == 8) {
+                            sum += (value - 128) / 128.0f;
+                        } else {
+                            sum += (int32_t)(value << (32 - bits)) / 2147483648.0f;
+                        }
+                    }
+                    samples[i] = sum / channels;
+                }
+                return true;
+            }
+            position += 8 + size + (size & 1);
+        }
+        error = "no audio data";
+        return false;
+    }
+
+    const DrumKit::Drum* DrumKit::getDrum(int key) const {
+        if (key < 0 || key >= keys || drums[key].length == 0) {
+            return nullptr;
+        }
+        return &drums[key];
+    }
+
+    const uint8_t* DrumKit::getData() const {
+        return arena.data();
+    }
+
+    uint32_t DrumKit::getId() const {
+        return id;
+    }
+
+    const std::string& DrumKit::getError() const {
+        return error;
+    }
+}
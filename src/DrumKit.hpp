@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace AyMidi {
+
+    // Drum samples as 4 bit chip levels, one per MIDI key, stored back to
+    // back in a single arena. Kits are built off the audio thread and only
+    // read while playing.
+    class DrumKit {
+
+        public:
+            constexpr static int keys = 128;
+            constexpr static int defaultRate = 8000;
+
+            struct Drum {
+                uint32_t offset = 0;
+                uint32_t length = 0;
+                int rate = 0;
+            };
+
+        private:
+            std::vector<uint8_t> arena;
+            Drum drums[keys];
+            uint32_t id;
+            std::string error;
+
+            bool loadWav(const std::string& path, std::vector<float>& samples, int& rate);
+
+        public:
+            DrumKit();
+            void buildDefault();
+            bool load(const std::string& directory);
+            void addSample(int key, const float* samples, size_t count, int rate);
+            const Drum* getDrum(int key) const;
+            // Drums play from their offset into this block.
+            const uint8_t* getData() const;
+            // Unique to the samples, copies share it. Unlike the address it
+            // is never reused by another kit.
+            uint32_t getId() const;
+            const std::string& getError() const;
+    };
+}
@@ -0,0 +1,495 @@
+#include <algorithm>
+#include <cstring>
+#include "DumpPlayer.hpp"
+
+namespace AyMidi {
+
+    static uint32_t readBigEndian(const uint8_t* data, int bytes) {
+        uint32_t value = 0;
+        for (int i = 0; i < bytes; i++) {
+            value = value << 8 | data[i];
+        }
+        return value;
+    }
+
+    static uint32_t readLittleEndian(const uint8_t* data, int bytes) {
+        uint32_t value = 0;
+        for (int i = bytes - 1; i >= 0; i--) {
+            value = value << 8 | data[i];
+        }
+        return value;
+    }
+
+    // ABC stereo.
+    static const float channelPan[3] = {0.25f, 0.5f, 0.75f};
+
+    DumpPlayer::DumpPlayer(double sampleRate) :
+        sampleRate(sampleRate)
+    {
+        for (int i = 0; i < maxChips; i++) {
+            sgs.push_back(std::make_unique<SoundGenerator>(sampleRate, 2000000));
+            sgs[i]->setGain(1.0f);
+        }
+    }
+
+    bool DumpPlayer::fail(const std::string& message) {
+        error = message;
+        finished = true;
+        decoder.reset();
+        frames.clear();
+        return false;
+    }
+
+    bool DumpPlayer::load(const std::string& path) {
+        finished = true;
+        decoder.reset();
+        frames.clear();
+        stream = nullptr;
+        streamSize = 0;
+        streamPosition = 0;
+        chips = 1;
+        if (!file.open(path)) {
+            return fail(file.getError());
+        }
+        const uint8_t* data = file.getData();
+        const size_t size = file.getSize();
+        bool loaded;
+        if (size >= 22 && data[2] == '-' && data[3] == 'l' && data[4] == 'h' && data[6] == '-') {
+            loaded = loadLha(data, size);
+        } else if (size >= 0x40 && std::memcmp(data, "Vgm ", 4) == 0) {
+            loaded = loadVgm(data, size);
+        } else if (size >= 16 && std::memcmp(data, "PSG\x1A", 4) == 0) {
+            loaded = loadPsg(data, size);
+        } else if (size >= 4 && data[0] == 'Y' && data[1] == 'M') {
+            stream = data;
+            streamSize = size;
+            loaded = loadYm(size);
+        } else if (size >= 2 && data[0] == 0x1F && data[1] == 0x8B) {
+            loaded = fail("compressed VGM files must be unpacked first");
+        } else {
+            loaded = fail("unknown file format");
+        }
+        if (loaded) {
+            start();
+        }
+        return loaded;
+    }
+
+    // Level 0, 1 and 2 headers, the first member is played.
+    bool DumpPlayer::loadLha(const uint8_t* data, size_t size) {
+        const int level = data[20];
+        size_t headerSize;
+        uint64_t packedSize = readLittleEndian(data + 7, 4);
+        const uint64_t originalSize = readLittleEndian(data + 11, 4);
+        if (level == 0 || level == 1) {
+            headerSize = data[0] + 2;
+            if (level == 1) {
+                // Extended headers are counted in the packed size.
+                size_t extension = readLittleEndian(data + headerSize - 2, 2);
+                while (extension != 0) {
+                    if (headerSize + extension > size || extension < 2 || packedSize < extension) {
+                        return fail("truncated LHA header");
+                    }
+                    headerSize += extension;
+                    packedSize -= extension;
+                    extension = readLittleEndian(data + headerSize - 2, 2);
+                }
+            }
+        } else if (level == 2) {
+            headerSize = readLittleEndian(data, 2);
+        } else {
+            return fail("unsupported LHA header level " + std::to_string(level));
+        }
+        if (headerSize > size || packedSize > size - headerSize) {
+            return fail("truncated LHA archive");
+        }
+        const char method = data[5];
+        const uint8_t* packed = data + headerSize;
+        if (method == '0') {
+            stream = packed;
+            streamSize = std::min<uint64_t>(packedSize, originalSize);
+        } else if (method >= '4' && method <= '7') {
+            const int dictionaryBits[] = {12, 13, 15, 16};
+            decoder = std::make_unique<LzhDecoder>(packed, packedSize, originalSize, dictionaryBits[method - '4']);
+        } else {
+            return fail(std::string("unsupported LHA method -lh") + method + "-");
+        }
+        return loadYm(originalSize);
+    }
+
+    bool DumpPlayer::readYm(uint8_t* data, size_t size) {
+        if (decoder != nullptr) {
+            return decoder->read(data, size) == size;
+        }
+        if (streamSize - streamPosition < size) {
+            return false;
+        }
+        std::memcpy(data, stream + streamPosition, size);
+        streamPosition += size;
+        return true;
+    }
+
+    bool DumpPlayer::skipYm(size_t size) {
+        if (decoder != nullptr) {
+            return decoder->skip(size);
+        }
+        if (streamSize - streamPosition < size) {
+            return false;
+        }
+        streamPosition += size;
+        return true;
+    }
+
+    bool DumpPlayer::loadYm(uint64_t size) {
+        format = YM;
+        clockRate = 2000000;
+        emul = YM2149;
+        tickRate = 50;
+        uint8_t id[4];
+        if (!readYm(id, 4)) {
+            return fail("truncated YM file");
+        }
+        if (std::memcmp(id, "YM2!", 4) == 0 || std::memcmp(id, "YM3!", 4) == 0 || std::memcmp(id, "YM3b", 4) == 0) {
+            const uint64_t trailer = id[3] == 'b' ? 4 : 0;
+            if (size < 4 + trailer + 14) {
+                return fail("empty YM file");
+            }
+            frameCount = (size - 4 - trailer) / 14;
+            frameSize = 14;
+            interleaved = true;
+        } else if (std::memcmp(id, "YM5!", 4) == 0 || std::memcmp(id, "YM6!", 4) == 0) {
+            uint8_t header[30];
+            if (!readYm(header, sizeof(header)) || std::memcmp(header, "LeOnArD!", 8) != 0) {
+                return fail("bad YM header");
+            }
+            frameCount = readBigEndian(header + 8, 4);
+            interleaved = readBigEndian(header + 12, 4) & 1;
+            const int drums = readBigEndian(header + 16, 2);
+            clockRate = readBigEndian(header + 18, 4);
+            tickRate = readBigEndian(header + 22, 2);
+            if (!skipYm(readBigEndian(header + 28, 2))) {
+                return fail("truncated YM header");
+            }
+            for (int i = 0; i < drums; i++) {
+                uint8_t drumSize[4];
+                if (!readYm(drumSize, 4) || !skipYm(readBigEndian(drumSize, 4))) {
+                    return fail("truncated YM digidrums");
+                }
+            }
+            // Song name, author and comment.
+            for (int i = 0; i < 3; i++) {
+                uint8_t byte;
+                do {
+                    if (!readYm(&byte, 1)) {
+                        return fail("truncated YM header");
+                    }
+                } while (byte != 0);
+            }
+            frameSize = 16;
+            if (frameCount == 0 || clockRate <= 0 || tickRate == 0) {
+                return fail("bad YM header");
+            }
+        } else {
+            return fail("unsupported YM version " + std::string((const char*)id, 4));
+        }
+        // Interleaved frames store every register as a plane, so the whole
+        // song is needed before the first frame can be played.
+        if (interleaved) {
+            if (frameCount > (size - 4) / frameSize) {
+                return fail("truncated YM frames");
+            }
+            frames.resize((size_t)frameCount * frameSize);
+            if (!readYm(frames.data(), frames.size())) {
+                return fail("truncated YM frames");
+            }
+        }
+        totalTicks = frameCount;
+        return true;
+    }
+
+    bool DumpPlayer::loadVgm(const uint8_t* data, size_t size) {
+        format = VGM;
+        tickRate = vgmSampleRate;
+        const uint32_t version = readLittleEndian(data + 0x08, 4);
+        size_t start = 0x40;
+        if (version >= 0x150 && readLittleEndian(data + 0x34, 4) != 0) {
+            start = 0x34 + readLittleEndian(data + 0x34, 4);
+        }
+        size_t end = std::min<uint64_t>(size, 0x04 + (uint64_t)readLittleEndian(data + 0x04, 4));
+        if (start >= end) {
+            return fail("truncated VGM file");
+        }
+        uint32_t clock = 0;
+        if (version >= 0x151 && start >= 0x7A) {
+            clock = readLittleEndian(data + 0x74, 4);
+        }
+        if ((clock & 0x3FFFFFFF) == 0) {
+            return fail("VGM file has no AY-3-8910 data");
+        }
+        clockRate = clock & 0x3FFFFFFF;
+        chips = clock & 1 << 30 ? 2 : 1;
+        emul = data[0x78] & 0x10 ? YM2149 : AY8910;
+        // YM2149 with the clock divider pin low.
+        if (data[0x79] & 0x10) {
+            clockRate /= 2;
+        }
+        stream = data + start;
+        streamSize = end - start;
+        totalTicks = readLittleEndian(data + 0x18, 4);
+        return true;
+    }
+
+    bool DumpPlayer::loadPsg(const uint8_t* data, size_t size) {
+        format = PSG;
+        clockRate = 1773400;
+        emul = AY8910;
+        tickRate = 50;
+        stream = data + 16;
+        streamSize = size - 16;
+        totalTicks = 0;
+        for (size_t i = 0; i < streamSize; i++) {
+            const uint8_t command = stream[i];
+            if (command == 0xFF) {
+                totalTicks++;
+            } else if (command == 0xFE) {
+                totalTicks += i + 1 < streamSize ? 4 * stream[++i] : 0;
+            } else if (command == 0xFD) {
+                break;
+            } else {
+                i++;
+            }
+        }
+        return true;
+    }
+
+    void DumpPlayer::start() {
+        for (int chip = 0; chip < chips; chip++) {
+            auto& sg = sgs[chip];
+            sg->setClockRate(clockRate);
+            sg->setEmul(emul);
+            for (int reg = 0; reg < AY_ENVELOPE_SHAPE; reg++) {
+                sg->setRegister(reg, reg == AY_MIXER ? 0x3F : 0);
+            }
+            for (int channel = 0; channel < 3; channel++) {
+                sg->setPan(channel, channelPan[channel]);
+            }
+            sg->commit();
+        }
+        frame = 0;
+        tick = 0;
+        position = 0;
+        nextEvent = 0;
+        finished = false;
+    }
+
+    void DumpPlayer::stepYm() {
+        if (frame >= frameCount) {
+            finished = true;
+            return;
+        }
+        uint8_t registers[16];
+        if (interleaved) {
+            for (int reg = 0; reg < frameSize; reg++) {
+                registers[reg] = frames[(size_t)reg * frameCount + frame];
+            }
+        } else if (!readYm(registers, frameSize)) {
+            finished = true;
+            return;
+        }
+        auto& sg = sgs[0];
+        for (int reg = 0; reg < AY_ENVELOPE_SHAPE; reg++) {
+            sg->setRegister(reg, registers[reg]);
+        }
+        // 0xFF leaves the envelope running.
+        if (registers[AY_ENVELOPE_SHAPE] != 0xFF) {
+            sg->setRegister(AY_ENVELOPE_SHAPE, registers[AY_ENVELOPE_SHAPE]);
+        }
+        frame++;
+        tick++;
+    }
+
+    // Applies writes up to the next wait. Commands for other chips are
+    // skipped by their length.
+    void DumpPlayer::stepVgm() {
+        while (streamPosition < streamSize) {
+            const uint8_t* command = stream + streamPosition;
+            const size_t available = streamSize - streamPosition;
+            const uint8_t code = command[0];
+            size_t length = 1;
+            uint32_t wait = 0;
+            if (code == 0xA0) {
+                length = 3;
+                if (available >= 3) {
+                    const int chip = command[1] >> 7;
+                    const int reg = command[1] & 0x7F;
+                    if (chip < chips && reg < AY_REGISTERS) {
+                        sgs[chip]->setRegister(reg, command[2]);
+                    }
+                }
+            } else if (code == 0x61) {
+                length = 3;
+                wait = available >= 3 ? readLittleEndian(command + 1, 2) : 0;
+            } else if (code == 0x62) {
+                wait = 735;
+            } else if (code == 0x63) {
+                wait = 882;
+            } else if (code == 0x66) {
+                length = available;
+            } else if (code == 0x67) {
+                length = available >= 7 ? 7 + (uint64_t)readLittleEndian(command + 3, 4) : available;
+            } else if (code == 0x68) {
+                length = 12;
+            } else if (code >= 0x70 && code <= 0x8F) {
+                wait = (code & 0x0F) + (code < 0x80);
+            } else if (code >= 0x90 && code <= 0x95) {
+                const int lengths[] = {5, 5, 6, 11, 2, 5};
+                length = lengths[code - 0x90];
+            } else if ((code >= 0x30 && code <= 0x3F) || code == 0x4F || code == 0x50) {
+                length = 2;
+            } else if ((code >= 0x40 && code <= 0x5F) || (code >= 0xA1 && code <= 0xBF)) {
+                length = 3;
+            } else if (code >= 0xC0 && code <= 0xDF) {
+                length = 4;
+            } else if (code >= 0xE0) {
+                length = 5;
+            }
+            streamPosition += std::min(length, available);
+            if (wait > 0) {
+                tick += wait;
+                return;
+            }
+        }
+        finished = true;
+    }
+
+    // Writes up to the next end of frame, 0xFE skips four frames per count.
+    void DumpPlayer::stepPsg() {
+        while (streamPosition < streamSize) {
+            const uint8_t code = stream[streamPosition++];
+            if (code == 0xFF) {
+                tick++;
+                return;
+            }
+            if (code == 0xFD) {
+                break;
+            }
+            if (streamPosition == streamSize) {
+                break;
+            }
+            const uint8_t value = stream[streamPosition++];
+            if (code == 0xFE) {
+                tick += 4 * value;
+                return;
+            }
+            if (code < AY_REGISTERS) {
+                sgs[0]->setRegister(code, value);
+            }
+        }
+        finished = true;
+    }
+
+    void DumpPlayer::step() {
+        switch (format) {
+            case YM:
+                stepYm();
+                break;
+            case VGM:
+                stepVgm();
+                break;
+            case PSG:
+                stepPsg();
+                break;
+        }
+        for (int chip = 0; chip < chips; chip++) {
+            sgs[chip]->commit();
+        }
+        nextEvent = tick * sampleRate / tickRate;
+    }
+
+    DumpPlayer::Format DumpPlayer::getFormat() const {
+        return format;
+    }
+
+    int DumpPlayer::getChips() const {
+        return chips;
+    }
+
+    int DumpPlayer::getClockRate() const {
+        return clockRate;
+    }
+
+    Emul DumpPlayer::getEmul() const {
+        return emul;
+    }
+
+    double DumpPlayer::getDuration() const {
+        return (double)totalTicks / tickRate;
+    }
+
+    void DumpPlayer::setQuality(Quality quality) {
+        for (auto& sg : sgs) {
+            sg->setQuality(quality);
+        }
+    }
+
+    void DumpPlayer::setGain(float gain) {
+        for (auto& sg : sgs) {
+            sg->setGain(gain);
+        }
+    }
+
+    bool DumpPlayer::isFinished() const {
+        return finished;
+    }
+
+    bool DumpPlayer::isIdle() const {
+        for (int chip = 0; chip < chips; chip++) {
+            if (!sgs[chip]->isIdle()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const std::string& DumpPlayer::getError() const {
+        return error;
+    }
+
+    void DumpPlayer::process(float* left, float* right, uint32_t size) {
+        while (size > 0) {
+            while (!finished && position >= nextEvent) {
+                step();
+            }
+            uint32_t count = size;
+            if (!finished) {
+                count = std::min<uint64_t>(count, nextEvent - position);
+            }
+            render(left, right, count);
+            position += count;
+            left += count;
+            right += count;
+            size -= count;
+        }
+    }
+
+    void DumpPlayer::render(float* left, float* right, uint32_t size) {
+        if (chips == 1) {
+            sgs[0]->process(left, right, size);
+            return;
+        }
+        uint32_t done = 0;
+        while (done < size) {
+            const int count = std::min(size - done, (uint32_t)Decimator::maxBlockSize);
+            for (int chip = 0; chip < chips; chip++) {
+                sgs[chip]->process(chipLeft[chip], chipRight[chip], count);
+            }
+            for (int i = 0; i < count; i++) {
+                left[i] = chipLeft[0][i] + chipLeft[1][i];
+                right[i] = chipRight[0][i] + chipRight[1][i];
+            }
+            left += count;
+            right += count;
+            done += count;
+        }
+    }
+}
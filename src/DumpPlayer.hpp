@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "LzhDecoder.hpp"
+#include "MappedFile.hpp"
+#include "SoundGenerator.hpp"
+
+namespace AyMidi {
+
+    // Plays YM (raw or LHA packed), VGM and PSG register dumps straight into
+    // the sound generators at the dump's own rate, without the MIDI engine.
+    class DumpPlayer {
+
+        public:
+            enum Format {
+                YM,
+                VGM,
+                PSG
+            };
+
+            constexpr static int maxChips = 2;
+            constexpr static int vgmSampleRate = 44100;
+
+        private:
+            std::vector<std::unique_ptr<SoundGenerator>> sgs;
+            double sampleRate;
+            MappedFile file;
+            std::unique_ptr<LzhDecoder> decoder;
+            Format format = YM;
+            int chips = 1;
+            int clockRate = 0;
+            Emul emul = YM2149;
+            uint32_t tickRate = 50;
+            // YM frames, decoded as a whole when stored register by register.
+            std::vector<uint8_t> frames;
+            uint32_t frameCount = 0;
+            uint32_t frame = 0;
+            int frameSize = 14;
+            bool interleaved = false;
+            // Raw YM data or VGM and PSG command streams.
+            const uint8_t* stream = nullptr;
+            size_t streamSize = 0;
+            size_t streamPosition = 0;
+            uint64_t totalTicks = 0;
+            uint64_t tick = 0;
+            uint64_t position = 0;
+            uint64_t nextEvent = 0;
+            bool finished = true;
+            std::string error;
+            float chipLeft[maxChips][Decimator::maxBlockSize];
+            float chipRight[maxChips][Decimator::maxBlockSize];
+
+            bool fail(const std::string& message);
+            bool readYm(uint8_t* data, size_t size);
+            bool skipYm(size_t size);
+            bool loadYm(uint64_t size);
+            bool loadLha(const uint8_t* data, size_t size);
+            bool loadVgm(const uint8_t* data, size_t size);
+            bool loadPsg(const uint8_t* data, size_t size);
+            void start();
+            void stepYm();
+            void stepVgm();
+            void stepPsg();
+            void step();
+            void render(float* left, float* right, uint32_t size);
+
+        public:
+            DumpPlayer(double sampleRate);
+            bool load(const std::string& path);
+            Format getFormat() const;
+            int getChips() const;
+            int getClockRate() const;
+            Emul getEmul() const;
+            double getDuration() const;
+            void setQuality(Quality quality);
+            void setGain(float gain);
+            bool isFinished() const;
+            bool isIdle() const;
+            const std::string& getError() const;
+            void process(float* left, float* right, uint32_t size);
+    };
+}
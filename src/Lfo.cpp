@@ -0,0 +1,82 @@
+#include <cmath>
+#include "Lfo.hpp"
+
+namespace AyMidi {
+
+    namespace {
+
+        constexpr int tableBits = 8;
+        constexpr int tableSize = 1 << tableBits;
+        constexpr int fractionBits = 32 - tableBits;
+
+        struct LfoTables {
+            float sine[tableSize];
+            float triangle[tableSize];
+
+            LfoTables() {
+                for (int i = 0; i < tableSize; i++) {
+                    sine[i] = std::sin(2.0 * M_PI * i / tableSize);
+                    float x = (float)i / tableSize;
+                    triangle[i] = x < 0.25f ? 4.0f * x : x < 0.75f ? 2.0f - 4.0f * x : 4.0f * x - 4.0f;
+                }
+            }
+        };
+
+        const LfoTables tables;
+
+        float lookup(const float* table, uint32_t phase) {
+            int index = phase >> fractionBits;
+            float fraction = (phase & ((1 << fractionBits) - 1)) * (1.0f / (1 << fractionBits));
+            float a = table[index];
+            float b = table[(index + 1) & (tableSize - 1)];
+            return a + (b - a) * fraction;
+        }
+    }
+
+    void Lfo::setWaveform(LfoWaveform waveform) {
+        this->waveform = waveform;
+    }
+
+    void Lfo::reset() {
+        phase = 0;
+        heldValue = nextRandom();
+    }
+
+    float Lfo::nextRandom() {
+        randomState = randomState * 1664525 + 1013904223;
+        return (int32_t)randomState * (1.0f / 2147483648.0f);
+    }
+
+    float Lfo::update(float rate, int updateRate) {
+        if (rate != this->rate || updateRate != this->updateRate) {
+            this->rate = rate;
+            this->updateRate = updateRate;
+            // Taken in 64 bits, as rates from the update rate up wrap around.
+            increment = (uint32_t)std::llround(rate / updateRate * 4294967296.0);
+        }
+        uint32_t previous = phase;
+        phase += increment;
+        switch (waveform) {
+            case LFO_SINE:
+                value = lookup(tables.sine, phase);
+                break;
+            case LFO_TRIANGLE:
+                value = lookup(tables.triangle, phase);
+                break;
+            case LFO_SQUARE:
+                value = phase < 0x80000000 ? 1.0f : -1.0f;
+                break;
+            case LFO_SAMPLE_HOLD:
+                if (phase < previous) {
+                    heldValue = nextRandom();
+                }
+                value = heldValue;
+                break;
+        }
+        return value;
+    }
+
+    float Lfo::getValue() const {
+        return value;
+    }
+}
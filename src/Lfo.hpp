@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+namespace AyMidi {
+
+    enum LfoWaveform {
+        LFO_SINE,
+        LFO_TRIANGLE,
+        LFO_SQUARE,
+        LFO_SAMPLE_HOLD
+    };
+
+    class Lfo {
+
+        private:
+            LfoWaveform waveform = LFO_SINE;
+            uint32_t phase = 0;
+            uint32_t increment = 0;
+            float rate = 0.0f;
+            int updateRate = 0;
+            float value = 0.0f;
+            float heldValue = 0.0f;
+            uint32_t randomState = 1;
+
+            float nextRandom();
+
+        public:
+            void setWaveform(LfoWaveform waveform);
+            void reset();
+            float update(float rate, int updateRate);
+            float getValue() const;
+    };
+}
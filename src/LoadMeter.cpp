@@ -0,0 +1,79 @@
+#include <algorithm>
+#include "LoadMeter.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define AYMIDI_LOADMETER_TSC
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define AYMIDI_LOADMETER_CNTVCT
+#endif
+
+namespace AyMidi {
+
+    LoadMeter::LoadMeter(double sampleRate, double window) :
+        sampleRate(sampleRate),
+        windowFrames(std::max(1.0, sampleRate * window)),
+        windowStart(readCycles()),
+        windowTime(Clock::now())
+    {
+    }
+
+    uint64_t LoadMeter::readCycles() {
+#if defined(AYMIDI_LOADMETER_TSC)
+        return __rdtsc();
+#elif defined(AYMIDI_LOADMETER_CNTVCT)
+        uint64_t value;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+        return value;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    void LoadMeter::begin() {
+        blockStart = readCycles();
+    }
+
+    // Returns true when a window has been completed and the loads updated.
+    bool LoadMeter::end(uint32_t blockFrames) {
+        const uint64_t now = readCycles();
+        const uint64_t cycles = now - blockStart;
+        busyCycles += cycles;
+        frames += blockFrames;
+        if (blockFrames > 0) {
+            peakCyclesPerFrame = std::max(peakCyclesPerFrame, (double)cycles / blockFrames);
+        }
+        if (frames < windowFrames) {
+            return false;
+        }
+        const Clock::time_point time = Clock::now();
+        const double elapsed = std::chrono::duration<double>(time - windowTime).count();
+        if (elapsed > 0.0 && now > windowStart) {
+            const double cyclesPerSecond = (now - windowStart) / elapsed;
+            mean = 100.0 * busyCycles / cyclesPerSecond / (frames / sampleRate);
+            peak = 100.0 * peakCyclesPerFrame / cyclesPerSecond * sampleRate;
+        }
+        seconds = frames / sampleRate;
+        windowStart = now;
+        windowTime = time;
+        busyCycles = 0;
+        frames = 0;
+        peakCyclesPerFrame = 0.0;
+        return true;
+    }
+
+    // Percent of the audio time, averaged over the last window.
+    float LoadMeter::getMean() const {
+        return mean;
+    }
+
+    // Percent of the audio time taken by the slowest block of the last window.
+    float LoadMeter::getPeak() const {
+        return peak;
+    }
+
+    // Audio seconds covered by the last window.
+    double LoadMeter::getWindow() const {
+        return seconds;
+    }
+}
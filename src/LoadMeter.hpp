@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace AyMidi {
+
+    // Time spent processing blocks against the audio time they cover. Blocks
+    // are timed with the CPU cycle counter, which is converted to seconds
+    // against the steady clock once per window.
+    class LoadMeter {
+
+        private:
+            typedef std::chrono::steady_clock Clock;
+
+            double sampleRate;
+            uint32_t windowFrames;
+            uint64_t blockStart = 0;
+            uint64_t windowStart;
+            Clock::time_point windowTime;
+            uint64_t busyCycles = 0;
+            uint32_t frames = 0;
+            double peakCyclesPerFrame = 0.0;
+            double seconds = 0.0;
+            std::atomic<float> mean{0.0f};
+            std::atomic<float> peak{0.0f};
+
+        public:
+            static uint64_t readCycles();
+
+            LoadMeter(double sampleRate, double window = 1.0);
+            void begin();
+            bool end(uint32_t blockFrames);
+            float getMean() const;
+            float getPeak() const;
+            double getWindow() const;
+    };
+}
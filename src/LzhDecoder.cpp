@@ -0,0 +1,240 @@
+#include <algorithm>
+#include "LzhDecoder.hpp"
+
+namespace AyMidi {
+
+    LzhDecoder::LzhDecoder(const uint8_t* data, size_t size, uint64_t originalSize, int dictionaryBits) :
+        input(data),
+        inputSize(size),
+        remaining(originalSize),
+        dictionaryBits(dictionaryBits),
+        positionBits(dictionaryBits > 13 ? 5 : 4),
+        window(1 << dictionaryBits, ' ')
+    {
+    }
+
+    // Bits past the end of the input read as zeros, a block that depends on
+    // them is caught as a failure when it runs far beyond.
+    void LzhDecoder::fill() {
+        while (bitCount <= 24) {
+            const uint32_t byte = inputPosition < inputSize ? input[inputPosition] : 0;
+            inputPosition++;
+            bitBuffer |= byte << (24 - bitCount);
+            bitCount += 8;
+        }
+    }
+
+    unsigned LzhDecoder::peekBits(int count) {
+        if (bitCount < count) {
+            fill();
+        }
+        return bitBuffer >> (32 - count);
+    }
+
+    unsigned LzhDecoder::getBits(int count) {
+        if (count == 0) {
+            return 0;
+        }
+        const unsigned value = peekBits(count);
+        bitBuffer <<= count;
+        bitCount -= count;
+        return value;
+    }
+
+    bool LzhDecoder::buildTree(Tree& tree, int size) {
+        tree.size = size;
+        tree.single = -1;
+        std::fill(tree.counts, tree.counts + 17, 0);
+        for (int i = 0; i < size; i++) {
+            tree.counts[tree.lengths[i]]++;
+        }
+        uint32_t total = 0;
+        for (int length = 1; length <= 16; length++) {
+            total += tree.counts[length] << (16 - length);
+        }
+        if (total != 1u << 16) {
+            return false;
+        }
+        int offsets[17];
+        offsets[1] = 0;
+        for (int length = 1; length < 16; length++) {
+            offsets[length + 1] = offsets[length] + tree.counts[length];
+        }
+        tree.symbols.resize(offsets[16] + tree.counts[16]);
+        for (int i = 0; i < size; i++) {
+            if (tree.lengths[i] > 0) {
+                tree.symbols[offsets[tree.lengths[i]]++] = i;
+            }
+        }
+        // Entries hold the symbol and its length, or 0 for longer codes.
+        tree.table.assign(1 << tableBits, 0);
+        uint32_t code = 0;
+        int index = 0;
+        for (int length = 1; length <= tableBits; length++) {
+            for (int i = 0; i < tree.counts[length]; i++) {
+                const int symbol = tree.symbols[index++];
+                const uint32_t first = code << (tableBits - length);
+                const uint32_t last = (code + 1) << (tableBits - length);
+                std::fill(tree.table.begin() + first, tree.table.begin() + last, symbol << 5 | length);
+                code++;
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+
+    int LzhDecoder::decode(const Tree& tree) {
+        if (tree.single >= 0) {
+            return tree.single;
+        }
+        const unsigned bits = peekBits(16);
+        const uint16_t entry = tree.table[bits >> (16 - tableBits)];
+        if (entry != 0) {
+            getBits(entry & 0x1F);
+            return entry >> 5;
+        }
+        uint32_t code = 0;
+        uint32_t first = 0;
+        int index = 0;
+        for (int length = 1; length <= 16; length++) {
+            code |= (bits >> (16 - length)) & 1;
+            const int count = tree.counts[length];
+            if (code - first < (uint32_t)count) {
+                getBits(length);
+                return tree.symbols[index + code - first];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+    bool LzhDecoder::readLengths(Tree& tree, int size, int countBits, int special) {
+        const int count = getBits(countBits);
+        if (count == 0) {
+            tree.single = getBits(countBits);
+            tree.size = size;
+            return tree.single < size;
+        }
+        if (count > size) {
+            return false;
+        }
+        std::fill(tree.lengths, tree.lengths + size, 0);
+        for (int i = 0; i < count;) {
+            int length = getBits(3);
+            if (length == 7) {
+                while (getBits(1)) {
+                    if (++length > 16) {
+                        return false;
+                    }
+                }
+            }
+            tree.lengths[i++] = length;
+            if (i == special) {
+                i += getBits(2);
+            }
+        }
+        return buildTree(tree, size);
+    }
+
+    bool LzhDecoder::readLiteralLengths() {
+        const int count = getBits(9);
+        if (count == 0) {
+            c.single = getBits(9);
+            c.size = NC;
+            return c.single < NC;
+        }
+        if (count > NC) {
+            return false;
+        }
+        std::fill(c.lengths, c.lengths + NC, 0);
+        for (int i = 0; i < count;) {
+            const int code = decode(t);
+            if (code < 0) {
+                return false;
+            }
+            if (code > 2) {
+                c.lengths[i++] = code - 2;
+                continue;
+            }
+            const int zeros = code == 0 ? 1 : code == 1 ? getBits(4) + 3 : getBits(9) + 20;
+            if (i + zeros > count) {
+                return false;
+            }
+            i += zeros;
+        }
+        return buildTree(c, NC);
+    }
+
+    bool LzhDecoder::readBlock() {
+        blockCodes = getBits(16);
+        return blockCodes > 0
+            && readLengths(t, NT, 5, 3)
+            && readLiteralLengths()
+            && readLengths(p, dictionaryBits + 1, positionBits, -1);
+    }
+
+    size_t LzhDecoder::read(uint8_t* output, size_t size) {
+        const uint32_t mask = window.size() - 1;
+        size_t done = 0;
+        size = std::min<uint64_t>(size, remaining);
+        while (done < size && !failed) {
+            if (copyLength > 0) {
+                const int count = std::min<size_t>(copyLength, size - done);
+                for (int i = 0; i < count; i++) {
+                    const uint8_t byte = window[(windowPosition - copyDistance) & mask];
+                    window[windowPosition++ & mask] = byte;
+                    output[done++] = byte;
+                }
+                copyLength -= count;
+                continue;
+            }
+            if (blockCodes == 0 && !readBlock()) {
+                failed = true;
+                break;
+            }
+            blockCodes--;
+            const int code = decode(c);
+            if (code < 0) {
+                failed = true;
+            } else if (code < 256) {
+                window[windowPosition++ & mask] = code;
+                output[done++] = code;
+            } else {
+                const int bits = decode(p);
+                if (bits < 0) {
+                    failed = true;
+                    break;
+                }
+                copyDistance = (bits == 0 ? 0 : (1u << (bits - 1)) + getBits(bits - 1)) + 1;
+                copyLength = code - 256 + threshold;
+            }
+            if (inputPosition * 8 - bitCount > inputSize * 8) {
+                failed = true;
+            }
+        }
+        remaining -= done;
+        return done;
+    }
+
+    bool LzhDecoder::skip(uint64_t size) {
+        uint8_t buffer[1024];
+        while (size > 0) {
+            const size_t count = read(buffer, std::min<uint64_t>(size, sizeof(buffer)));
+            if (count == 0) {
+                return false;
+            }
+            size -= count;
+        }
+        return true;
+    }
+
+    bool LzhDecoder::isFinished() const {
+        return remaining == 0;
+    }
+
+    bool LzhDecoder::hasFailed() const {
+        return failed;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace AyMidi {
+
+    // Incremental -lh4- to -lh7- decompressor. Output is produced on demand
+    // in any amount, the input is only read as far as needed.
+    class LzhDecoder {
+
+        private:
+            constexpr static int maxMatch = 256;
+            constexpr static int threshold = 3;
+            constexpr static int NC = 256 + maxMatch - threshold + 1;
+            constexpr static int NT = 19;
+            constexpr static int maxNP = 17;
+            constexpr static int tableBits = 10;
+
+            // Canonical Huffman code with a lookup table for short codes.
+            struct Tree {
+                int size = 0;
+                int single = -1;
+                uint8_t lengths[NC];
+                int counts[17];
+                std::vector<uint16_t> symbols;
+                std::vector<uint16_t> table;
+            };
+
+            const uint8_t* input;
+            size_t inputSize;
+            size_t inputPosition = 0;
+            uint64_t remaining;
+            uint32_t bitBuffer = 0;
+            int bitCount = 0;
+            int dictionaryBits;
+            int positionBits;
+            std::vector<uint8_t> window;
+            uint32_t windowPosition = 0;
+            int blockCodes = 0;
+            int copyLength = 0;
+            uint32_t copyDistance = 0;
+            bool failed = false;
+            Tree c;
+            Tree t;
+            Tree p;
+
+            void fill();
+            unsigned peekBits(int count);
+            unsigned getBits(int count);
+            bool buildTree(Tree& tree, int size);
+            int decode(const Tree& tree);
+            bool readLengths(Tree& tree, int size, int countBits, int special);
+            bool readLiteralLengths();
+            bool readBlock();
+
+        public:
+            LzhDecoder(const uint8_t* data, size_t size, uint64_t originalSize, int dictionaryBits = 13);
+            size_t read(uint8_t* output, size_t size);
+            bool skip(uint64_t size);
+            bool isFinished() const;
+            bool hasFailed() const;
+    };
+}
@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include "LzhEncoder.hpp"
+
+namespace AyMidi {
+
+    // Huffman code lengths limited to 16 bits. Returns the only used symbol
+    // when there are less than two, which is sent without a tree, or -1.
+    static int makeLengths(const uint32_t* freq, int n, uint8_t* lengths) {
+        std::fill(lengths, lengths + n, 0);
+        std::vector<int> symbols;
+        for (int i = 0; i < n; i++) {
+            if (freq[i] > 0) {
+                symbols.push_back(i);
+            }
+        }
+        if (symbols.size() < 2) {
+            return symbols.empty() ? 0 : symbols[0];
+        }
+
+        struct Node {
+            uint64_t freq;
+            int left;
+            int right;
+        };
+        std::vector<Node> nodes;
+        typedef std::pair<uint64_t, int> Entry;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+        for (int symbol : symbols) {
+            heap.push({freq[symbol], (int)nodes.size()});
+            nodes.push_back({freq[symbol], -1, -1});
+        }
+        while (heap.size() > 1) {
+            Entry a = heap.top();
+            heap.pop();
+            Entry b = heap.top();
+            heap.pop();
+            heap.push({a.first + b.first, (int)nodes.size()});
+            nodes.push_back({a.first + b.first, a.second, b.second});
+        }
+
+        int lengthCount[17] = {0};
+        std::vector<std::pair<int, int>> stack = {{heap.top().second, 0}};
+        while (!stack.empty()) {
+            auto [node, depth] = stack.back();
+            stack.pop_back();
+            if (nodes[node].left < 0) {
+                lengthCount[std::min(depth, 16)]++;
+            } else {
+                stack.push_back({nodes[node].left, depth + 1});
+                stack.push_back({nodes[node].right, depth + 1});
+            }
+        }
+
+        // Rebalance after clamping so the code stays complete.
+        uint32_t cum = 0;
+        for (int i = 1; i <= 16; i++) {
+            cum += lengthCount[i] << (16 - i);
+        }
+        while (cum != 1u << 16) {
+            lengthCount[16]--;
+            for (int i = 15; i > 0; i--) {
+                if (lengthCount[i] != 0) {
+                    lengthCount[i]--;
+                    lengthCount[i + 1] += 2;
+                    break;
+                }
+            }
+            cum--;
+        }
+
+        // Least frequent symbols take the longest codes.
+        std::stable_sort(symbols.begin(), symbols.end(), [freq](int a, int b) {
+            return freq[a] < freq[b];
+        });
+        int index = 0;
+        for (int length = 16; length > 0; length--) {
+            for (int i = 0; i < lengthCount[length]; i++) {
+                lengths[symbols[index++]] = length;
+            }
+        }
+        return -1;
+    }
+
+    // Some decoders reject literal and length trees with a single symbol,
+    // this gives it an unused sibling.
+    static void padSingleSymbol(uint32_t* freq, int n) {
+        int used = -1;
+        for (int i = 0; i < n; i++) {
+            if (freq[i] > 0) {
+                if (used >= 0) {
+                    return;
+                }
+                used = i;
+            }
+        }
+        if (used >= 0) {
+            freq[used == 0 ? 1 : 0] = 1;
+        }
+    }
+
+    static void makeCodes(int n, const uint8_t* lengths, uint16_t* codes) {
+        int count[17] = {0};
+        for (int i = 0; i < n; i++) {
+            count[lengths[i]]++;
+        }
+        uint16_t start[18];
+        start[1] = 0;
+        for (int i = 1; i <= 16; i++) {
+            start[i + 1] = (start[i] + count[i]) << 1;
+        }
+        for (int i = 0; i < n; i++) {
+            codes[i] = lengths[i] > 0 ? start[lengths[i]]++ : 0;
+        }
+    }
+
+    static int bitLength(unsigned value) {
+        int length = 0;
+        while (value != 0) {
+            value >>= 1;
+            length++;
+        }
+        return length;
+    }
+
+    LzhEncoder::LzhEncoder(FILE* output) :
+        output(output),
+        window(2 * dictionarySize + maxMatch),
+        hashHead(1 << hashBits, -1),
+        hashPrev(window.size(), -1)
+    {
+        codes.reserve(blockCodes);
+        distances.reserve(blockCodes);
+    }
+
+    int LzhEncoder::hash(int pos) const {
+        return ((window[pos] << 10) ^ (window[pos + 1] << 5) ^ window[pos + 2]) & ((1 << hashBits) - 1);
+    }
+
+    void LzhEncoder::insert(int pos) {
+        if (pos + threshold > available) {
+            return;
+        }
+        const int h = hash(pos);
+        hashPrev[pos] = hashHead[h];
+        hashHead[h] = pos;
+    }
+
+    int LzhEncoder::findMatch(int pos, int limit, int& distance) const {
+        int best = 0;
+        int candidate = hashHead[hash(pos)];
+        for (int chain = 0; candidate >= 0 && pos - candidate < dictionarySize && chain < maxChain; chain++) {
+            if (window[candidate + best] == window[pos + best]) {
+                int length = 0;
+                while (length < limit && window[candidate + length] == window[pos + length]) {
+                    length++;
+                }
+                if (length > best) {
+                    best = length;
+                    distance = pos - candidate;
+                    if (length == limit) {
+                        break;
+                    }
+                }
+            }
+            candidate = hashPrev[candidate];
+        }
+        return best;
+    }
+
+    void LzhEncoder::slide() {
+        std::memmove(window.data(), window.data() + dictionarySize, available - dictionarySize);
+        position -= dictionarySize;
+        available -= dictionarySize;
+        for (auto& head : hashHead) {
+            head = head >= dictionarySize ? head - dictionarySize : -1;
+        }
+        for (size_t i = 0; i + dictionarySize < hashPrev.size(); i++) {
+            const int prev = hashPrev[i + dictionarySize];
+            hashPrev[i] = prev >= dictionarySize ? prev - dictionarySize : -1;
+        }
+        std::fill(hashPrev.end() - dictionarySize, hashPrev.end(), -1);
+    }
+
+    // Encodes buffered input, keeping maxMatch bytes of lookahead unless
+    // flushing.
+    void LzhEncoder::encode(bool flush) {
+        while (position < available && (flush || available - position >= maxMatch)) {
+            const int limit = std::min(maxMatch, available - position);
+            int distance = 0;
+            int length = limit >= threshold ? findMatch(position, limit, distance) : 0;
+            if (length >= threshold) {
+                codes.push_back(256 + length - threshold);
+                distances.push_back(distance - 1);
+                for (int i = 0; i < length; i++) {
+                    insert(position++);
+                }
+            } else {
+                codes.push_back(window[position]);
+                distances.push_back(0);
+                insert(position++);
+            }
+            if ((int)codes.size() == blockCodes) {
+                sendBlock();
+            }
+        }
+    }
+
+    void LzhEncoder::write(const uint8_t* data, size_t size) {
+        while (size > 0) {
+            if (available == (int)window.size()) {
+                slide();
+            }
+            const size_t count = std::min(size, window.size() - available);
+            std::memcpy(&window[available], data, count);
+            available += count;
+            data += count;
+            size -= count;
+            encode(false);
+        }
+    }
+
+    void LzhEncoder::putBits(int count, unsigned value) {
+        for (int i = count - 1; i >= 0; i--) {
+            bitBuffer = bitBuffer << 1 | ((value >> i) & 1);
+            if (++bitCount == 8) {
+                bytes.push_back(bitBuffer);
+                bitBuffer = 0;
+                bitCount = 0;
+            }
+        }
+    }
+
+    void LzhEncoder::flushBytes() {
+        if (bytes.empty()) {
+            return;
+        }
+        if (std::fwrite(bytes.data(), 1, bytes.size(), output) != bytes.size()) {
+            failed = true;
+        }
+        compressedSize += bytes.size();
+        bytes.clear();
+    }
+
+    void LzhEncoder::sendBlock() {
+        if (codes.empty()) {
+            return;
+        }
+        uint32_t cFreq[NC] = {0};
+        uint32_t pFreq[NP] = {0};
+        for (size_t i = 0; i < codes.size(); i++) {
+            cFreq[codes[i]]++;
+            if (codes[i] >= 256) {
+                pFreq[bitLength(distances[i])]++;
+            }
+        }
+        uint8_t cLen[NC];
+        uint16_t cCode[NC];
+        uint8_t tLen[NT];
+        uint16_t tCode[NT];
+        uint8_t pLen[NP];
+        uint16_t pCode[NP];
+
+        padSingleSymbol(cFreq, NC);
+        putBits(16, codes.size());
+        makeLengths(cFreq, NC, cLen);
+        makeCodes(NC, cLen, cCode);
+        int n = NC;
+        while (n > 0 && cLen[n - 1] == 0) {
+            n--;
+        }
+        // Runs of unused codes are packed into symbols 0 to 2.
+        uint32_t tFreq[NT] = {0};
+        for (int i = 0; i < n;) {
+            const int k = cLen[i++];
+            if (k == 0) {
+                int count = 1;
+                while (i < n && cLen[i] == 0) {
+                    i++;
+                    count++;
+                }
+                if (count <= 2) {
+                    tFreq[0] += count;
+                } else if (count <= 18) {
+                    tFreq[1]++;
+                } else if (count == 19) {
+                    tFreq[0]++;
+                    tFreq[1]++;
+                } else {
+                    tFreq[2]++;
+                }
+            } else {
+                tFreq[k + 2]++;
+            }
+        }
+        padSingleSymbol(tFreq, NT);
+        makeLengths(tFreq, NT, tLen);
+        makeCodes(NT, tLen, tCode);
+        int m = NT;
+        while (m > 0 && tLen[m - 1] == 0) {
+            m--;
+        }
+        putBits(5, m);
+        for (int i = 0; i < m;) {
+            const int k = tLen[i++];
+            if (k <= 6) {
+                putBits(3, k);
+            } else {
+                putBits(k - 3, (1u << (k - 3)) - 2);
+            }
+            if (i == 3) {
+                while (i < 6 && tLen[i] == 0) {
+                    i++;
+                }
+                putBits(2, (i - 3) & 3);
+            }
+        }
+        putBits(9, n);
+        for (int i = 0; i < n;) {
+            const int k = cLen[i++];
+            if (k == 0) {
+                int count = 1;
+                while (i < n && cLen[i] == 0) {
+                    i++;
+                    count++;
+                }
+                if (count <= 2) {
+                    for (int j = 0; j < count; j++) {
+                        putBits(tLen[0], tCode[0]);
+                    }
+                } else if (count <= 18) {
+                    putBits(tLen[1], tCode[1]);
+                    putBits(4, count - 3);
+                } else if (count == 19) {
+                    putBits(tLen[0], tCode[0]);
+                    putBits(tLen[1], tCode[1]);
+                    putBits(4, 15);
+                } else {
+                    putBits(tLen[2], tCode[2]);
+                    putBits(9, count - 20);
+                }
+            } else {
+                putBits(tLen[k + 2], tCode[k + 2]);
+            }
+        }
+
+        const int pRoot = makeLengths(pFreq, NP, pLen);
+        if (pRoot < 0) {
+            makeCodes(NP, pLen, pCode);
+            int m = NP;
+            while (m > 0 && pLen[m - 1] == 0) {
+                m--;
+            }
+            putBits(4, m);
+            for (int i = 0; i < m; i++) {
+                const int k = pLen[i];
+                if (k <= 6) {
+                    putBits(3, k);
+                } else {
+                    putBits(k - 3, (1u << (k - 3)) - 2);
+                }
+            }
+        } else {
+            std::fill(pCode, pCode + NP, 0);
+            putBits(4, 0);
+            putBits(4, pRoot);
+        }
+
+        for (size_t i = 0; i < codes.size(); i++) {
+            const int c = codes[i];
+            putBits(cLen[c], cCode[c]);
+            if (c >= 256) {
+                const unsigned d = distances[i];
+                const int bits = bitLength(d);
+                putBits(pLen[bits], pCode[bits]);
+                if (bits > 1) {
+                    putBits(bits - 1, d & ((1u << (bits - 1)) - 1));
+                }
+            }
+        }
+        codes.clear();
+        distances.clear();
+        flushBytes();
+    }
+
+    bool LzhEncoder::finish() {
+        encode(true);
+        sendBlock();
+        if (bitCount > 0) {
+            putBits(8 - bitCount, 0);
+        }
+        flushBytes();
+        return !failed;
+    }
+
+    uint32_t LzhEncoder::getCompressedSize() const {
+        return compressedSize;
+    }
+
+    uint16_t LzhEncoder::crc16(uint16_t crc, const uint8_t* data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; bit++) {
+                crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+            }
+        }
+        return crc;
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace AyMidi {
+
+    // Streaming -lh5- compressor (LZ77 with an 8 KiB window and static
+    // Huffman blocks) as used by LHA archives and YM files.
+    class LzhEncoder {
+
+        private:
+            constexpr static int dictionaryBits = 13;
+            constexpr static int dictionarySize = 1 << dictionaryBits;
+            constexpr static int maxMatch = 256;
+            constexpr static int threshold = 3;
+            constexpr static int maxChain = 128;
+            constexpr static int hashBits = 14;
+            constexpr static int blockCodes = 16384;
+            constexpr static int NC = 256 + maxMatch - threshold + 1;
+            constexpr static int NT = 19;
+            constexpr static int NP = dictionaryBits + 1;
+
+            FILE* output;
+            std::vector<uint8_t> window;
+            std::vector<int> hashHead;
+            std::vector<int> hashPrev;
+            int position = 0;
+            int available = 0;
+            std::vector<uint16_t> codes;
+            std::vector<uint16_t> distances;
+            std::vector<uint8_t> bytes;
+            uint32_t bitBuffer = 0;
+            int bitCount = 0;
+            uint32_t compressedSize = 0;
+            bool failed = false;
+
+            int hash(int pos) const;
+            void insert(int pos);
+            int findMatch(int pos, int limit, int& distance) const;
+            void slide();
+            void encode(bool flush);
+            void putBits(int count, unsigned value);
+            void flushBytes();
+            void sendBlock();
+
+        public:
+            explicit LzhEncoder(FILE* output);
+            void write(const uint8_t* data, size_t size);
+            bool finish();
+            uint32_t getCompressedSize() const;
+
+            // CRC-16/ARC as stored in LHA headers.
+            static uint16_t crc16(uint16_t crc, const uint8_t* data, size_t size);
+    };
+}
@@ -0,0 +1,81 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include "MappedFile.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace AyMidi {
+
+    MappedFile::~MappedFile() {
+        close();
+    }
+
+    bool MappedFile::open(const std::string& path) {
+        close();
+#ifndef _WIN32
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = path + ": " + std::strerror(errno);
+            return false;
+        }
+        struct stat status;
+        if (fstat(fd, &status) != 0) {
+            error = path + ": " + std::strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        size = status.st_size;
+        if (size > 0) {
+            void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                madvise(address, size, MADV_SEQUENTIAL);
+                data = static_cast<const uint8_t*>(address);
+                mapped = true;
+                ::close(fd);
+                return true;
+            }
+        }
+        ::close(fd);
+#endif
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            error = "can't open " + path;
+            return false;
+        }
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+        return true;
+    }
+
+    void MappedFile::close() {
+#ifndef _WIN32
+        if (mapped) {
+            munmap(const_cast<uint8_t*>(data), size);
+        }
+#endif
+        mapped = false;
+        buffer.clear();
+        data = nullptr;
+        size = 0;
+    }
+
+    const uint8_t* MappedFile::getData() const {
+        return data;
+    }
+
+    size_t MappedFile::getSize() const {
+        return size;
+    }
+
+    const std::string& MappedFile::getError() const {
+        return error;
+    }
+}
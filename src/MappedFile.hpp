@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace AyMidi {
+
+    // Read-only view of a whole file, memory mapped where available.
+    class MappedFile {
+
+        private:
+            const uint8_t* data = nullptr;
+            size_t size = 0;
+            bool mapped = false;
+            std::vector<uint8_t> buffer;
+            std::string error;
+
+        public:
+            MappedFile() = default;
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+            ~MappedFile();
+            bool open(const std::string& path);
+            void close();
+            const uint8_t* getData() const;
+            size_t getSize() const;
+            const std::string& getError() const;
+    };
+}
@@ -1,28 +1,31 @@
-#include <math.h>
 #include "Note.hpp"
 
 namespace AyMidi {
 
     Note::Note(ChannelData* params, int key, int velocity, int channelId) :
         params(params),
-        key(key),
-        velocity(velocity),
+        startKey(0),
         channelId(channelId),
-        startKey(0)
+        key(key),
+        velocity(velocity)
     {
         setup = true;
         valid = true;
         released = false;
-        if (params->portamentoControl > 0) {
+        if (params != nullptr && params->portamentoControl > 0) {
             startKey = params->portamentoControl;
             params->portamentoControl = 0;
         }
     }
 
-    void Note::setVoice(std::shared_ptr<Voice> voice) {
+    void Note::setVoice(Voice* voice) {
         this->voice = voice;
     }
 
+    Voice* Note::getVoice() const {
+        return voice;
+    }
+
     void Note::release() {
         released = true;
     }
@@ -53,33 +56,16 @@ namespace AyMidi {
         return (int)(envelopeLevel * velocity * params->volume / 128.0f * 16.0f);
     }
 
-    float Note::getNoteFreq(const double key) const {
-        return 440.0f * pow(2, (key - 69) / 12.0f);
-    }
-
-    int Note::getSquareFreq(int updateRate) const {
+    float Note::getPitch(int updateRate) const {
         auto vibratoPitch = 0.0f;
         if (params->vibratoDepth > 0 && params->vibratoRate > 0 && (10.0f * timeCounter / updateRate) >= params->vibratoDelay) {
-            vibratoPitch = params->vibratoDepth * std::sin(params->vibratoRate * timeCounter / updateRate * 2.0f * M_PI);
+            vibratoPitch = params->vibratoDepth * params->vibrato;
         }
         auto portamentoPitch = 0.0f;
         if (params->portamento && params->portamentoTime > 0 && (10.0f * timeCounter / updateRate < params->portamentoTime) && startKey != 0) {
             portamentoPitch = startKey + (key - startKey) * 10.0f * timeCounter / updateRate / params->portamentoTime - key;
         }
-        return getNoteFreq(key + envelopePitch + vibratoPitch + portamentoPitch + params->squareDetune + params->pitchBend * 12.0f);
-    }
-
-    int Note::getBuzzerFreq(int updateRate) const {
-        auto vibratoPitch = 0.0f;
-        if (params->vibratoDepth > 0 && params->vibratoRate > 0 && (10.0f * timeCounter / updateRate) >= params->vibratoDelay) {
-            vibratoPitch = params->vibratoDepth * std::sin(params->vibratoRate * timeCounter / updateRate * 2.0f * M_PI);
-        }
-        auto portamentoPitch = 0.0f;
-        if (params->portamento && params->portamentoTime > 0 && (10.0f * timeCounter / updateRate < params->portamentoTime) && startKey != 0) {
-            portamentoPitch = startKey + (key - startKey) * 10.0f * timeCounter / updateRate / params->portamentoTime - key;
-        }
-        float mult = params->buzzerWaveform == 2 || params->buzzerWaveform == 6 ? 2.0f : 1.0f;
-        return getNoteFreq(key + envelopePitch + vibratoPitch + portamentoPitch + params->buzzerDetune + params->pitchBend * 12.0f);
+        return key + envelopePitch + vibratoPitch + portamentoPitch + params->pitchBend * 12.0f;
     }
 
     void Note::updateEnvelope() {
@@ -129,6 +115,7 @@ namespace AyMidi {
     }
 
     void Note::update(int updateRate) {
+        float pitch = getPitch(updateRate);
         voice->enableEnvelope(params->buzzer);
         voice->enableTone(params->square);
         if (params->buzzer) {
@@ -136,16 +123,78 @@ namespace AyMidi {
                 voice->setEnvelopeShape(params->buzzerWaveform + 8);
                 setup = false;
             }
-            voice->setEnvelopeFreq(getBuzzerFreq(updateRate));
+            voice->setEnvelopePitch(pitch + params->buzzerDetune);
         }
         if (params->square) {
             voice->setLevel(getLevel());
-            voice->setToneFreq(getSquareFreq(updateRate));
+            voice->setTonePitch(pitch + params->squareDetune);
         }
         voice->enableNoise(params->noisePeriod > 0);
         if (params->noisePeriod > 0) {
             voice->setNoisePeriod(params->noisePeriod);
         }
         voice->setPan(params->pan);
+        const float timerPitch = pitch + params->timerDetune;
+        switch (params->timerEffect) {
+            case TIMER_SYNC_BUZZER:
+                voice->setSyncBuzzer(timerPitch);
+                break;
+            case TIMER_SYNC_SQUARE:
+                voice->setSyncSquare(timerPitch);
+                break;
+            case TIMER_SID:
+                voice->setSid(timerPitch);
+                break;
+            default:
+                voice->stopTimer();
+                break;
+        }
+    }
+
+    // Plays the first envelope step as soon as the note arrives, the next
+    // ones follow the update ticks.
+    void Note::start(int updateRate) {
+        if (voice == nullptr) {
+            return;
+        }
+        updateEnvelope();
+        if (valid) {
+            update(updateRate);
+        }
+    }
+
+    void Note::save(State& state) const {
+        state.inRelease = inRelease;
+        state.envelopeLevel = envelopeLevel;
+        state.releaseStartLevel = releaseStartLevel;
+        state.timeCounter = timeCounter;
+        state.releaseCounter = releaseCounter;
+        state.envelopePitch = envelopePitch;
+        state.setup = setup;
+        state.released = released;
+        state.valid = valid;
+        state.startKey = startKey;
+        state.channelId = channelId;
+        state.key = key;
+        state.velocity = velocity;
+        state.pressure = pressure;
+    }
+
+    void Note::restore(const State& state, ChannelData* params) {
+        this->params = params;
+        inRelease = state.inRelease;
+        envelopeLevel = state.envelopeLevel;
+        releaseStartLevel = state.releaseStartLevel;
+        timeCounter = state.timeCounter;
+        releaseCounter = state.releaseCounter;
+        envelopePitch = state.envelopePitch;
+        setup = state.setup;
+        released = state.released;
+        valid = state.valid;
+        startKey = state.startKey;
+        channelId = state.channelId;
+        key = state.key;
+        velocity = state.velocity;
+        pressure = state.pressure;
     }
 }
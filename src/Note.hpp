@@ -1,6 +1,5 @@
 #pragma once
 
-#include <memory>
 #include "types.hpp"
 #include "Voice.hpp"
 
@@ -10,31 +9,51 @@ namespace AyMidi {
 
         private:
             ChannelData* params;
-            std::shared_ptr<Voice> voice;
-            bool inRelease;
-            float envelopeLevel;
-            float releaseStartLevel;
+            Voice* voice = nullptr;
+            bool inRelease = false;
+            float envelopeLevel = 0.0f;
+            float releaseStartLevel = 0.0f;
             unsigned timeCounter = 0;
-            unsigned releaseCounter;
-            float envelopePitch;
+            unsigned releaseCounter = 0;
+            float envelopePitch = 0.0f;
             bool setup;
             bool released;
             bool valid;
             int startKey;
 
-            float getNoteFreq(const double key) const;
             int getLevel() const;
-            int getSquareFreq(int updateRate) const;
-            int getBuzzerFreq(int updateRate) const;
+            float getPitch(int updateRate) const;
 
         public:
+            // Voice and free list links are kept by the pool, as indices.
+            struct State {
+                bool inRelease;
+                float envelopeLevel;
+                float releaseStartLevel;
+                unsigned timeCounter;
+                unsigned releaseCounter;
+                float envelopePitch;
+                bool setup;
+                bool released;
+                bool valid;
+                int startKey;
+                int channelId;
+                int key;
+                int velocity;
+                int pressure;
+                int voice;
+                int nextFree;
+            };
+
             int channelId;
             int key;
             int velocity;
-            int pressure;
+            int pressure = 0;
+            Note* nextFree = nullptr;
 
             Note(ChannelData* params, int key, int velocity, int channelId);
-            void setVoice(std::shared_ptr<Voice> voice);
+            void setVoice(Voice* voice);
+            Voice* getVoice() const;
             void release();
             void drop();
             bool isValid();
@@ -43,5 +62,8 @@ namespace AyMidi {
             void setStartKey(int key);
             void updateEnvelope();
             void update(int updateRate);
+            void start(int updateRate);
+            void save(State& state) const;
+            void restore(const State& state, ChannelData* params);
     };
 }
@@ -0,0 +1,67 @@
+#include "NotePool.hpp"
+#include "VoiceProcessor.hpp"
+
+namespace AyMidi {
+
+    NotePool::NotePool() :
+        notes(capacity, Note(nullptr, 0, 0, 0)),
+        freeList(nullptr),
+        used(capacity)
+    {
+        for (auto& note : notes) {
+            release(&note);
+        }
+    }
+
+    Note* NotePool::acquire(ChannelData* params, int key, int velocity, int channelId) {
+        Note* note = freeList;
+        if (note == nullptr) {
+            return nullptr;
+        }
+        freeList = note->nextFree;
+        *note = Note(params, key, velocity, channelId);
+        used++;
+        return note;
+    }
+
+    void NotePool::release(Note* note) {
+        note->nextFree = freeList;
+        freeList = note;
+        used--;
+    }
+
+    int NotePool::getUsed() const {
+        return used;
+    }
+
+    // Notes are stored by index so states can move between pools, -1 stands
+    // for no note.
+    int NotePool::indexOf(const Note* note) const {
+        return note == nullptr ? -1 : note - notes.data();
+    }
+
+    Note* NotePool::getNote(int index) {
+        return index < 0 ? nullptr : &notes[index];
+    }
+
+    void NotePool::save(State& state, const VoiceProcessor& vp) const {
+        for (int i = 0; i < capacity; i++) {
+            notes[i].save(state.notes[i]);
+            state.notes[i].voice = vp.indexOf(notes[i].getVoice());
+            state.notes[i].nextFree = indexOf(notes[i].nextFree);
+        }
+        state.freeList = indexOf(freeList);
+        state.used = used;
+    }
+
+    // Params are looked up by the notes' channel.
+    void NotePool::restore(const State& state, VoiceProcessor& vp, ChannelData* const* params) {
+        for (int i = 0; i < capacity; i++) {
+            notes[i].restore(state.notes[i], params[state.notes[i].channelId]);
+            notes[i].setVoice(vp.getVoice(state.notes[i].voice));
+            notes[i].nextFree = getNote(state.notes[i].nextFree);
+        }
+        freeList = getNote(state.freeList);
+        used = state.used;
+    }
+}
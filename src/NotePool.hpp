@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include "Note.hpp"
+
+namespace AyMidi {
+
+    class VoiceProcessor;
+
+    class NotePool {
+
+        private:
+            std::vector<Note> notes;
+            Note* freeList;
+            int used;
+
+        public:
+            constexpr static int capacity = 256;
+
+            struct State {
+                Note::State notes[capacity];
+                int freeList;
+                int used;
+            };
+
+            NotePool();
+            Note* acquire(ChannelData* params, int key, int velocity, int channelId);
+            void release(Note* note);
+            int getUsed() const;
+            int indexOf(const Note* note) const;
+            Note* getNote(int index);
+            void save(State& state, const VoiceProcessor& vp) const;
+            void restore(const State& state, VoiceProcessor& vp, ChannelData* const* params);
+    };
+}
@@ -0,0 +1,63 @@
+#include <chrono>
+#include "RegisterCapture.hpp"
+
+namespace AyMidi {
+
+    RegisterCapture::~RegisterCapture() {
+        stop();
+    }
+
+    RegisterLog* RegisterCapture::getLog() {
+        return &log;
+    }
+
+    bool RegisterCapture::start(const std::string& path, RegisterWriter::Format format, int clockRate, int updateRate, Emul emul) {
+        stop();
+        log.clear();
+        failed = !writer.open(path, format, clockRate, updateRate, emul);
+        if (failed) {
+            writer.close();
+            return false;
+        }
+        running = true;
+        thread = std::thread(&RegisterCapture::drainLoop, this);
+        return true;
+    }
+
+    bool RegisterCapture::stop() {
+        if (!running.exchange(false)) {
+            return true;
+        }
+        thread.join();
+        drain();
+        return writer.close() && !failed;
+    }
+
+    bool RegisterCapture::isRunning() const {
+        return running;
+    }
+
+    void RegisterCapture::drain() {
+        RegisterFrame frame;
+        while (log.pop(frame)) {
+            if (!failed && !writer.write(frame)) {
+                failed = true;
+            }
+        }
+    }
+
+    void RegisterCapture::drainLoop() {
+        while (running) {
+            drain();
+            std::this_thread::sleep_for(std::chrono::milliseconds(drainInterval));
+        }
+    }
+
+    uint32_t RegisterCapture::getDropped() const {
+        return log.getDropped();
+    }
+
+    const std::string& RegisterCapture::getError() const {
+        return writer.getError();
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include "RegisterLog.hpp"
+#include "RegisterWriter.hpp"
+
+namespace AyMidi {
+
+    // Drains a register log to a file on a background thread. The log
+    // lives as long as the capture, so the engine may keep pushing into it
+    // after stop() without harm.
+    class RegisterCapture {
+
+        private:
+            constexpr static int drainInterval = 20;
+
+            RegisterLog log;
+            RegisterWriter writer;
+            std::thread thread;
+            std::atomic<bool> running{false};
+            bool failed = false;
+
+            void drain();
+            void drainLoop();
+
+        public:
+            ~RegisterCapture();
+            RegisterLog* getLog();
+            bool start(const std::string& path, RegisterWriter::Format format, int clockRate, int updateRate, Emul emul);
+            bool stop();
+            bool isRunning() const;
+            uint32_t getDropped() const;
+            const std::string& getError() const;
+    };
+}
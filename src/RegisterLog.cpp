@@ -0,0 +1,44 @@
+#include "RegisterLog.hpp"
+
+namespace AyMidi {
+
+    RegisterLog::RegisterLog(int capacity) {
+        int size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        frames.resize(size);
+        mask = size - 1;
+    }
+
+    RegisterFrame* RegisterLog::beginPush() {
+        const uint32_t position = head.load(std::memory_order_relaxed);
+        if (position - tail.load(std::memory_order_acquire) > mask) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &frames[position & mask];
+    }
+
+    void RegisterLog::endPush() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool RegisterLog::pop(RegisterFrame& frame) {
+        const uint32_t position = tail.load(std::memory_order_relaxed);
+        if (position == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        frame = frames[position & mask];
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    void RegisterLog::clear() {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    uint32_t RegisterLog::getDropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace AyMidi {
+
+    // Register state of every active chip at the end of an update tick.
+    struct RegisterFrame {
+        constexpr static int maxChips = 8;
+
+        uint32_t tick;
+        int chips;
+        uint8_t registers[maxChips][14];
+        // Registers written during the tick, R13 is only set when the
+        // envelope was retriggered.
+        uint16_t written[maxChips];
+        // Timer effects running on each channel and how often they fire,
+        // their writes between ticks are not in the registers.
+        uint8_t timerEffects[maxChips][3];
+        float timerRates[maxChips][3];
+    };
+
+    // Single producer, single consumer queue of frames. The audio thread
+    // pushes one frame per tick and never blocks. Frames pushed while the
+    // queue is full are dropped and show up as gaps in the tick numbers.
+    class RegisterLog {
+
+        private:
+            std::vector<RegisterFrame> frames;
+            uint32_t mask;
+            std::atomic<uint32_t> head{0};
+            std::atomic<uint32_t> tail{0};
+            std::atomic<uint32_t> dropped{0};
+
+        public:
+            RegisterLog(int capacity = 4096);
+            RegisterFrame* beginPush();
+            void endPush();
+            bool pop(RegisterFrame& frame);
+            // Consumer side, discards every pending frame.
+            void clear();
+            uint32_t getDropped() const;
+    };
+}
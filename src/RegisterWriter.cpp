@@ -0,0 +1,429 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include "LzhEncoder.hpp"
+#include "RegisterWriter.hpp"
+
+namespace AyMidi {
+
+    static void putLittleEndian(uint8_t* data, uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            data[i] = value >> (8 * i);
+        }
+    }
+
+    static void putBigEndian(std::vector<uint8_t>& data, uint32_t value, int bytes) {
+        for (int i = bytes - 1; i >= 0; i--) {
+            data.push_back(value >> (8 * i));
+        }
+    }
+
+    static std::string baseName(const std::string& path) {
+        const size_t slash = path.find_last_of('/');
+        return slash == std::string::npos ? path : path.substr(slash + 1);
+    }
+
+    // YM6 effects run from an MFP timer clocked at 2457600 Hz through one of
+    // these predividers and an 8 bit count. Only two effects fit in a frame
+    // and sync square has none.
+    static void putYmEffects(uint8_t* registers, const RegisterFrame& frame) {
+        constexpr static int predividers[8] = {0, 4, 10, 16, 50, 64, 100, 200};
+        constexpr static int slots[2][3] = {{1, 6, 14}, {3, 8, 15}};
+        int slot = 0;
+        for (int i = 0; i < 3 && slot < 2; i++) {
+            int type;
+            if (frame.timerEffects[0][i] == TIMER_SID) {
+                type = 0x00;
+            } else if (frame.timerEffects[0][i] == TIMER_SYNC_BUZZER) {
+                type = 0xC0;
+            } else {
+                continue;
+            }
+            int predivider = 7;
+            int count = 255;
+            for (int p = 1; p < 8; p++) {
+                const double ticks = std::round(2457600.0 / predividers[p] / frame.timerRates[0][i]);
+                if (ticks <= 255) {
+                    predivider = p;
+                    count = std::max(ticks, 1.0);
+                    break;
+                }
+            }
+            registers[slots[slot][0]] |= type | (i + 1) << 4;
+            registers[slots[slot][1]] |= predivider << 5;
+            registers[slots[slot][2]] = count;
+            slot++;
+        }
+    }
+
+    RegisterWriter::~RegisterWriter() {
+        close();
+    }
+
+    bool RegisterWriter::open(const std::string& path, Format format, int clockRate, int updateRate, Emul emul) {
+        close();
+        this->path = path;
+        this->format = format;
+        this->clockRate = clockRate;
+        this->updateRate = updateRate;
+        this->emul = emul;
+        frames = 0;
+        nextTick = 0;
+        vgmChips = 1;
+        vgmSamples = 0;
+        vgmSize = 0;
+        for (auto& timers : vgmTimers) {
+            std::fill(std::begin(timers), std::end(timers), VgmTimer());
+        }
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            error = path + ": " + std::strerror(errno);
+            return false;
+        }
+        if (format == YM) {
+            // Frames are stored register by register, so they are spooled
+            // until the total is known.
+            spool = std::tmpfile();
+            if (spool == nullptr) {
+                error = std::strerror(errno);
+                return false;
+            }
+            return true;
+        }
+        return writeVgmHeader();
+    }
+
+    bool RegisterWriter::put(const uint8_t* data, size_t size) {
+        if (std::fwrite(data, 1, size, file) != size) {
+            error = std::strerror(errno);
+            return false;
+        }
+        vgmSize += size;
+        return true;
+    }
+
+    bool RegisterWriter::write(const RegisterFrame& frame) {
+        if (file == nullptr) {
+            return false;
+        }
+        const bool first = frames == 0;
+        if (first) {
+            nextTick = frame.tick;
+        }
+        if (frame.tick - nextTick > 0x7FFFFFFF) {
+            return true;
+        }
+
+        if (format == YM) {
+            // Dropped frames repeat the previous state.
+            while (nextTick != frame.tick) {
+                lastYm[AY_ENVELOPE_SHAPE] = 0xFF;
+                if (!writeYmFrame(lastYm)) {
+                    return false;
+                }
+                nextTick++;
+            }
+            std::memcpy(lastYm, frame.registers[0], AY_REGISTERS);
+            if (!first && !(frame.written[0] & 1 << AY_ENVELOPE_SHAPE)) {
+                lastYm[AY_ENVELOPE_SHAPE] = 0xFF;
+            }
+            lastYm[14] = 0;
+            lastYm[15] = 0;
+            putYmEffects(lastYm, frame);
+            if (!writeYmFrame(lastYm)) {
+                return false;
+            }
+        } else if (!writeVgmFrame(frame, first)) {
+            return false;
+        }
+        nextTick = frame.tick + 1;
+        return true;
+    }
+
+    bool RegisterWriter::writeYmFrame(const uint8_t* registers) {
+        if (std::fwrite(registers, 16, 1, spool) != 1) {
+            error = std::strerror(errno);
+            return false;
+        }
+        frames++;
+        return true;
+    }
+
+    bool RegisterWriter::writeVgmWait(uint64_t samples) {
+        while (samples > vgmSamples) {
+            const uint64_t wait = samples - vgmSamples;
+            uint8_t command[3];
+            size_t size;
+            uint32_t count;
+            if (wait == 735 || wait == 882) {
+                command[0] = wait == 735 ? 0x62 : 0x63;
+                size = 1;
+                count = wait;
+            } else if (wait <= 16) {
+                command[0] = 0x70 + wait - 1;
+                size = 1;
+                count = wait;
+            } else {
+                count = std::min<uint64_t>(wait, 0xFFFF);
+                command[0] = 0x61;
+                putLittleEndian(command + 1, count, 2);
+                size = 3;
+            }
+            if (!put(command, size)) {
+                return false;
+            }
+            vgmSamples += count;
+        }
+        return true;
+    }
+
+    bool RegisterWriter::writeVgmRegister(int chip, int reg, uint8_t value) {
+        const uint8_t command[3] = {0xA0, (uint8_t)(reg | chip << 7), value};
+        return put(command, sizeof(command));
+    }
+
+    // Registers are written when they change, the envelope shape also when
+    // it was retriggered. Second chip writes set bit 7 of the address.
+    bool RegisterWriter::writeVgmFrame(const RegisterFrame& frame, bool first) {
+        const uint64_t ticks = frames + (uint64_t)(frame.tick - nextTick);
+        const uint64_t samples = ticks * vgmSampleRate / updateRate;
+        if (!writeVgmTimers(samples) || !writeVgmWait(samples)) {
+            return false;
+        }
+        const int chips = std::min(frame.chips, 2);
+        vgmChips = std::max(vgmChips, chips);
+        for (int chip = 0; chip < chips; chip++) {
+            for (int reg = 0; reg < AY_REGISTERS; reg++) {
+                const uint8_t value = frame.registers[chip][reg];
+                const bool retrigger = reg == AY_ENVELOPE_SHAPE && (frame.written[chip] & 1 << reg);
+                if (!first && value == last[chip][reg] && !retrigger) {
+                    continue;
+                }
+                // A level written while a SID timer holds it low stays low.
+                const VgmTimer* timer = reg >= AY_LEVEL && reg < AY_LEVEL + 3 ? &vgmTimers[chip][reg - AY_LEVEL] : nullptr;
+                const bool low = timer != nullptr && timer->effect == TIMER_SID && !timer->high;
+                if (!writeVgmRegister(chip, reg, low ? value & 0x10 : value)) {
+                    return false;
+                }
+                last[chip][reg] = value;
+            }
+        }
+        if (!setVgmTimers(frame, samples)) {
+            return false;
+        }
+        frames = ticks + 1;
+        return true;
+    }
+
+    // Writes the timer effects firing before the given sample, in order.
+    bool RegisterWriter::writeVgmTimers(uint64_t samples) {
+        for (;;) {
+            int chip = -1;
+            int channel = 0;
+            for (int c = 0; c < vgmChips; c++) {
+                for (int i = 0; i < 3; i++) {
+                    const VgmTimer& timer = vgmTimers[c][i];
+                    if (timer.effect != TIMER_OFF && timer.next < samples
+                            && (chip < 0 || timer.next < vgmTimers[chip][channel].next)) {
+                        chip = c;
+                        channel = i;
+                    }
+                }
+            }
+            if (chip < 0) {
+                return true;
+            }
+            VgmTimer& timer = vgmTimers[chip][channel];
+            if (!writeVgmWait((uint64_t)timer.next) || !fireVgmTimer(chip, channel)) {
+                return false;
+            }
+            timer.next += timer.interval;
+        }
+    }
+
+    bool RegisterWriter::fireVgmTimer(int chip, int channel) {
+        VgmTimer& timer = vgmTimers[chip][channel];
+        timer.high = !timer.high;
+        switch (timer.effect) {
+            case TIMER_SYNC_BUZZER:
+                return writeVgmRegister(chip, AY_ENVELOPE_SHAPE, last[chip][AY_ENVELOPE_SHAPE]);
+            case TIMER_SYNC_SQUARE:
+                return writeVgmRegister(chip, AY_ENVELOPE_SHAPE, timer.high ? 0x0D : 0x09);
+            case TIMER_SID: {
+                const uint8_t level = last[chip][AY_LEVEL + channel];
+                return writeVgmRegister(chip, AY_LEVEL + channel, timer.high ? level : level & 0x10);
+            }
+            default:
+                return true;
+        }
+    }
+
+    // Follows the timers like the generator does, a new effect starts a
+    // period after the frame and a new rate keeps the phase. Stopped
+    // effects leave the chip as the registers say.
+    bool RegisterWriter::setVgmTimers(const RegisterFrame& frame, uint64_t samples) {
+        const int chips = std::min(frame.chips, 2);
+        for (int chip = 0; chip < 2; chip++) {
+            for (int i = 0; i < 3; i++) {
+                VgmTimer& timer = vgmTimers[chip][i];
+                const uint8_t effect = chip < chips ? frame.timerEffects[chip][i] : (uint8_t)TIMER_OFF;
+                if (effect != timer.effect) {
+                    bool ok = true;
+                    if (timer.effect == TIMER_SYNC_SQUARE) {
+                        ok = writeVgmRegister(chip, AY_ENVELOPE_SHAPE, last[chip][AY_ENVELOPE_SHAPE]);
+                    } else if (timer.effect == TIMER_SID && !timer.high) {
+                        ok = writeVgmRegister(chip, AY_LEVEL + i, last[chip][AY_LEVEL + i]);
+                    }
+                    if (!ok) {
+                        return false;
+                    }
+                    timer.effect = TIMER_OFF;
+                }
+                if (effect == TIMER_OFF) {
+                    continue;
+                }
+                timer.interval = std::max(vgmSampleRate / (double)frame.timerRates[chip][i], 1.0);
+                if (timer.effect == TIMER_OFF) {
+                    timer.effect = effect;
+                    timer.next = samples + timer.interval;
+                    timer.high = true;
+                } else {
+                    timer.next = std::min(timer.next, samples + timer.interval);
+                }
+            }
+        }
+        return true;
+    }
+
+    // VGM 1.71 header, sizes are patched on close.
+    bool RegisterWriter::writeVgmHeader() {
+        uint8_t header[0x100] = {0};
+        std::memcpy(header, "Vgm ", 4);
+        putLittleEndian(header + 0x04, vgmSize + sizeof(header) - 4, 4);
+        putLittleEndian(header + 0x08, 0x171, 4);
+        putLittleEndian(header + 0x18, vgmSamples, 4);
+        putLittleEndian(header + 0x34, sizeof(header) - 0x34, 4);
+        putLittleEndian(header + 0x74, clockRate | (vgmChips > 1 ? 1u << 30 : 0), 4);
+        header[0x78] = emul == YM2149 ? 0x10 : 0x00;
+        header[0x79] = 0x01;
+        if (std::fwrite(header, sizeof(header), 1, file) != 1) {
+            error = std::strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    // YM6 file in an LHA level 0 archive.
+    bool RegisterWriter::packYm() {
+        const std::string name = baseName(path).substr(0, 200);
+        const size_t dot = name.find_last_of('.');
+        std::vector<uint8_t> ym;
+        const char* magic = "YM6!LeOnArD!";
+        ym.insert(ym.end(), magic, magic + 12);
+        putBigEndian(ym, frames, 4);
+        putBigEndian(ym, 1, 4);
+        putBigEndian(ym, 0, 2);
+        putBigEndian(ym, clockRate, 4);
+        putBigEndian(ym, updateRate, 2);
+        putBigEndian(ym, 0, 4);
+        putBigEndian(ym, 0, 2);
+        const std::string title = name.substr(0, dot);
+        ym.insert(ym.end(), title.begin(), title.end());
+        ym.push_back(0);
+        ym.push_back(0);
+        const char* comment = "AyMidi";
+        ym.insert(ym.end(), comment, comment + std::strlen(comment) + 1);
+
+        std::vector<uint8_t> header(24 + name.size());
+        if (std::fwrite(header.data(), header.size(), 1, file) != 1) {
+            error = std::strerror(errno);
+            return false;
+        }
+        LzhEncoder encoder(file);
+        uint16_t crc = LzhEncoder::crc16(0, ym.data(), ym.size());
+        encoder.write(ym.data(), ym.size());
+        std::vector<uint8_t> chunk(16 * 4096);
+        std::vector<uint8_t> column(4096);
+        for (int reg = 0; reg < 16; reg++) {
+            std::rewind(spool);
+            size_t count;
+            while ((count = std::fread(chunk.data(), 16, 4096, spool)) > 0) {
+                for (size_t i = 0; i < count; i++) {
+                    column[i] = chunk[16 * i + reg];
+                }
+                crc = LzhEncoder::crc16(crc, column.data(), count);
+                encoder.write(column.data(), count);
+            }
+            if (std::ferror(spool)) {
+                error = std::strerror(errno);
+                return false;
+            }
+        }
+        const uint8_t end[4] = {'E', 'n', 'd', '!'};
+        crc = LzhEncoder::crc16(crc, end, sizeof(end));
+        encoder.write(end, sizeof(end));
+        if (!encoder.finish() || std::fputc(0, file) == EOF) {
+            error = std::strerror(errno);
+            return false;
+        }
+
+        const std::time_t now = std::time(nullptr);
+        const std::tm* local = std::localtime(&now);
+        const uint32_t dosTime = (local->tm_year - 80) << 25 | (local->tm_mon + 1) << 21 | local->tm_mday << 16
+            | local->tm_hour << 11 | local->tm_min << 5 | local->tm_sec / 2;
+        header[0] = 22 + name.size();
+        std::memcpy(&header[2], "-lh5-", 5);
+        putLittleEndian(&header[7], encoder.getCompressedSize(), 4);
+        putLittleEndian(&header[11], ym.size() + 16 * frames + sizeof(end), 4);
+        putLittleEndian(&header[15], dosTime, 4);
+        header[19] = 0x20;
+        header[20] = 0;
+        header[21] = name.size();
+        std::memcpy(&header[22], name.data(), name.size());
+        putLittleEndian(&header[22 + name.size()], crc, 2);
+        uint8_t sum = 0;
+        for (size_t i = 2; i < header.size(); i++) {
+            sum += header[i];
+        }
+        header[1] = sum;
+        if (std::fseek(file, 0, SEEK_SET) != 0 || std::fwrite(header.data(), header.size(), 1, file) != 1) {
+            error = std::strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    bool RegisterWriter::close() {
+        if (file == nullptr) {
+            return true;
+        }
+        bool ok;
+        if (format == YM) {
+            ok = packYm();
+            std::fclose(spool);
+            spool = nullptr;
+        } else {
+            const uint8_t end = 0x66;
+            const uint64_t samples = (uint64_t)frames * vgmSampleRate / updateRate;
+            ok = writeVgmTimers(samples) && writeVgmWait(samples) && put(&end, 1)
+                && std::fseek(file, 0, SEEK_SET) == 0 && writeVgmHeader();
+        }
+        if (std::fclose(file) != 0 && ok) {
+            error = std::strerror(errno);
+            ok = false;
+        }
+        file = nullptr;
+        return ok;
+    }
+
+    uint32_t RegisterWriter::getFrames() const {
+        return frames;
+    }
+
+    const std::string& RegisterWriter::getError() const {
+        return error;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include "RegisterLog.hpp"
+#include "SoundGenerator.hpp"
+
+namespace AyMidi {
+
+    // Streams captured register frames to disk. YM6 files hold the first
+    // chip only and are LZH packed on close from a spool file, VGM files
+    // hold up to two chips as timestamped writes. Timer effects become YM6
+    // effects or VGM writes between the frames.
+    class RegisterWriter {
+
+        public:
+            enum Format {
+                YM,
+                VGM
+            };
+
+            constexpr static int vgmSampleRate = 44100;
+
+        private:
+            FILE* file = nullptr;
+            FILE* spool = nullptr;
+            Format format = YM;
+            std::string path;
+            int clockRate = 0;
+            int updateRate = 0;
+            Emul emul = YM2149;
+            uint32_t frames = 0;
+            uint32_t nextTick = 0;
+            int vgmChips = 1;
+            uint64_t vgmSamples = 0;
+            uint32_t vgmSize = 0;
+            uint8_t last[2][AY_REGISTERS];
+            // Timers replayed into VGM files, in VGM samples.
+            struct VgmTimer {
+                uint8_t effect = TIMER_OFF;
+                double interval = 0.0;
+                double next = 0.0;
+                bool high = true;
+            };
+            VgmTimer vgmTimers[2][3];
+            uint8_t lastYm[16];
+            std::string error;
+
+            bool put(const uint8_t* data, size_t size);
+            bool writeYmFrame(const uint8_t* registers);
+            bool writeVgmWait(uint64_t samples);
+            bool writeVgmRegister(int chip, int reg, uint8_t value);
+            bool writeVgmTimers(uint64_t samples);
+            bool fireVgmTimer(int chip, int channel);
+            bool setVgmTimers(const RegisterFrame& frame, uint64_t samples);
+            bool writeVgmFrame(const RegisterFrame& frame, bool first);
+            bool writeVgmHeader();
+            bool packYm();
+
+        public:
+            ~RegisterWriter();
+            bool open(const std::string& path, Format format, int clockRate, int updateRate, Emul emul);
+            bool write(const RegisterFrame& frame);
+            bool close();
+            uint32_t getFrames() const;
+            const std::string& getError() const;
+    };
+}
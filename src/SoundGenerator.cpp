@@ -1,4 +1,7 @@
-#include "DistrhoUtils.hpp"
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <iterator>
 #include "SoundGenerator.hpp"
 
 extern "C" double YM_dac_table[];
@@ -6,20 +9,35 @@ extern "C" double AY_dac_table[];
 
 namespace AyMidi {
 
-    extern "C" {
-#include "ayumi.h"
-    }
+    // Output samples after which the interpolator, FIR and DC filter have
+    // all settled on a constant input.
+    static const int settleSamples = DC_FILTER_SIZE + FIR_SIZE;
+
+    static const uint8_t registerMasks[AY_REGISTERS] = {
+        0xFF, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F, 0x1F, 0xFF, 0x1F, 0x1F, 0x1F, 0xFF, 0xFF, 0x0F
+    };
 
     SoundGenerator::SoundGenerator(double sampleRate, int clockRate) :
+        ayumi(std::make_unique<struct ayumi>()),
         sampleRate(sampleRate),
-        ayumi(std::make_shared<struct ayumi>())
+        frequencies(getFrequencies().data())
     {
-        ayumi_configure(&*ayumi, emul, clockRate, sampleRate);
+        ayumi_configure(ayumi.get(), emul, clockRate, sampleRate);
         setClockRate(clockRate);
+        // Mirror the state left by ayumi_configure.
+        std::fill(std::begin(registers), std::end(registers), 0);
+        for (int i = 0; i < 3; i++) {
+            registers[AY_TONE_FINE + 2 * i] = 1;
+            pan[i] = 0.0f;
+        }
+        registers[AY_ENVELOPE_FINE] = 1;
+        events.reserve(maxEvents);
     }
 
-    std::shared_ptr<struct ayumi> SoundGenerator::getAyumi() {
-        return ayumi;
+    SoundGenerator::~SoundGenerator() = default;
+
+    struct ayumi* SoundGenerator::getAyumi() {
+        return ayumi.get();
     }
 
     int SoundGenerator::getSampleRate() {
@@ -27,10 +45,10 @@ namespace AyMidi {
     }
 
     int SoundGenerator::setClockRate(int clockRate) {
-        ayumi->step = clockRate / (sampleRate * 8 * DECIMATE_FACTOR); // XXX Ayumi internals
+        ayumi->step = std::llround(clockRate / (sampleRate * 8 * decimatorLeft.getFactor()) * PHASE_ONE); // XXX Ayumi internals
         this->clockRate = clockRate;
         this->clockStep = clockRate / sampleRate;
-        return ayumi->step < 1;
+        return ayumi->step < PHASE_ONE;
     }
 
     int SoundGenerator::getClockRate() const {
@@ -38,54 +56,643 @@ namespace AyMidi {
     }
 
     void SoundGenerator::setEmul(Emul emul) {
+        this->emul = emul;
+        constantSamples = 0;
         ayumi->dac_table = emul == YM2149 ? YM_dac_table : AY_dac_table; // XXX Ayumi internals
     }
 
+    Emul SoundGenerator::getEmul() const {
+        return emul;
+    }
+
+    void SoundGenerator::setQuality(Quality quality) {
+        const double factor = (double)decimatorLeft.getFactor();
+        decimatorLeft.setQuality(quality);
+        decimatorRight.setQuality(quality);
+        setClockRate(clockRate);
+        for (auto& timer : timers) {
+            timer.period *= decimatorLeft.getFactor() / factor;
+            timer.counter *= decimatorLeft.getFactor() / factor;
+        }
+        for (auto& stream : streams) {
+            stream.period *= decimatorLeft.getFactor() / factor;
+            stream.counter *= decimatorLeft.getFactor() / factor;
+        }
+        constantSamples = 0;
+        centeredSamples = 0;
+    }
+
+    Quality SoundGenerator::getQuality() const {
+        return decimatorLeft.getQuality();
+    }
+
     void SoundGenerator::enableRemoveDc(bool enable) {
+        constantSamples = 0;
         removeDc = enable;
     }
 
+    bool SoundGenerator::isRemovingDc() const {
+        return removeDc;
+    }
+
     void SoundGenerator::setGain(float gain) {
         this->gain = gain;
     }
 
-    int SoundGenerator::freqToSquarePeriod(const double freq) const {
-        return std::min((int)std::round(clockRate / 16.0f / freq), 0x0FFF);
+    float SoundGenerator::getGain() const {
+        return gain;
+    }
+
+    // One table for every chip and clock rate, periods are worked out from
+    // it for the chip clock, so clock rate changes build nothing.
+    const std::vector<double>& SoundGenerator::getFrequencies() {
+        static const std::vector<double> frequencies = [] {
+            std::vector<double> frequencies(pitchTableSize);
+            for (int i = 0; i < pitchTableSize; i++) {
+                double pitch = pitchMin + (double)i / pitchSteps;
+                frequencies[i] = 440.0 * std::pow(2.0, (pitch - 69) / 12.0);
+            }
+            return frequencies;
+        }();
+        return frequencies;
+    }
+
+    double SoundGenerator::pitchToFrequency(float pitch) const {
+        float position = (pitch - pitchMin) * pitchSteps + 0.5f;
+        return frequencies[(int)std::min(std::max(position, 0.0f), pitchTableSize - 1.0f)];
+    }
+
+    int SoundGenerator::pitchToTonePeriod(float pitch) const {
+        return std::min(std::round(clockRate / 16.0 / pitchToFrequency(pitch)), (double)0x0FFF);
+    }
+
+    int SoundGenerator::pitchToEnvelopePeriod(float pitch) const {
+        return std::min(std::round(clockRate / 256.0 / pitchToFrequency(pitch)), (double)0xFFFF);
+    }
+
+    void SoundGenerator::setRegister(int reg, int value) {
+        value &= registerMasks[reg];
+        // Writing the envelope shape restarts the envelope even if unchanged.
+        if (registers[reg] != value || reg == AY_ENVELOPE_SHAPE) {
+            registers[reg] = value;
+            dirtyRegisters |= 1 << reg;
+        }
+    }
+
+    int SoundGenerator::getRegister(int reg) const {
+        return registers[reg];
     }
 
-    int SoundGenerator::freqToBuzzerPeriod(const double freq) const {
-        return std::min((int)std::round(clockRate / 256.0f / freq), 0xFFFF);
+    void SoundGenerator::setTonePeriod(int channel, int period) {
+        setRegister(AY_TONE_FINE + 2 * channel, period & 0xFF);
+        setRegister(AY_TONE_COARSE + 2 * channel, period >> 8);
+    }
+
+    void SoundGenerator::enableTone(int channel, bool enable) {
+        int mixer = registers[AY_MIXER] & ~(1 << channel);
+        setRegister(AY_MIXER, mixer | (enable ? 0 : 1 << channel));
+    }
+
+    void SoundGenerator::enableNoise(int channel, bool enable) {
+        int mixer = registers[AY_MIXER] & ~(8 << channel);
+        setRegister(AY_MIXER, mixer | (enable ? 0 : 8 << channel));
+    }
+
+    void SoundGenerator::enableEnvelope(int channel, bool enable) {
+        int level = registers[AY_LEVEL + channel] & 0x0F;
+        setRegister(AY_LEVEL + channel, level | (enable ? 0x10 : 0));
+    }
+
+    void SoundGenerator::setLevel(int channel, int level) {
+        int envelope = registers[AY_LEVEL + channel] & 0x10;
+        setRegister(AY_LEVEL + channel, envelope | (level & 0x0F));
+    }
+
+    void SoundGenerator::setPan(int channel, float pan) {
+        if (this->pan[channel] != pan) {
+            this->pan[channel] = pan;
+            dirtyPan |= 1 << channel;
+        }
     }
 
     void SoundGenerator::setNoisePeriod(int period) {
-        ayumi_set_noise(&*ayumi, period);
+        setRegister(AY_NOISE_PERIOD, period);
     }
 
     void SoundGenerator::setEnvelopePeriod(int period) {
-        ayumi_set_envelope(&*ayumi, period);
+        setRegister(AY_ENVELOPE_FINE, period & 0xFF);
+        setRegister(AY_ENVELOPE_COARSE, period >> 8);
     }
 
-    void SoundGenerator::setEnvelopeFreq(int freq) {
-        ayumi_set_envelope(&*ayumi, freqToBuzzerPeriod(freq));
+    void SoundGenerator::setEnvelopeShape(int shape) {
+        if (shape != registers[AY_ENVELOPE_SHAPE]) {
+            setRegister(AY_ENVELOPE_SHAPE, shape);
+        }
     }
 
-    void SoundGenerator::setEnvelopeShape(int shape) {
-        if (shape != lastEnvShape) {
-            ayumi_set_envelope_shape(&*ayumi, shape);
-            lastEnvShape = shape;
+    // Timers run freely and only change period while the effect stays, so
+    // per tick updates don't reset their phase. SID toggles twice and sync
+    // square once per half period.
+    void SoundGenerator::setTimer(int channel, TimerEffect effect, float pitch) {
+        Timer& timer = timers[channel];
+        if (effect != timer.effect) {
+            stopTimer(channel);
+        }
+        if (effect == TIMER_OFF) {
+            return;
+        }
+        double period = sampleRate * decimatorLeft.getFactor() / pitchToFrequency(pitch);
+        if (effect != TIMER_SYNC_BUZZER) {
+            period /= 2;
+        }
+        timer.period = std::max(period, 1.0);
+        if (timer.effect == TIMER_OFF) {
+            timer.effect = effect;
+            timer.counter = timer.period;
+            timer.high = true;
+            activeTimers |= 1 << channel;
+            constantSamples = 0;
+        } else {
+            timer.counter = std::min(timer.counter, timer.period);
         }
     }
 
+    // Leaves the chip as the registers say.
+    void SoundGenerator::stopTimer(int channel) {
+        Timer& timer = timers[channel];
+        if (timer.effect == TIMER_SYNC_SQUARE) {
+            ayumi_set_envelope_shape(ayumi.get(), registers[AY_ENVELOPE_SHAPE]);
+        } else if (timer.effect == TIMER_SID && !(activeStreams & (1 << channel))) {
+            ayumi_set_volume(ayumi.get(), channel, levels[channel]);
+        }
+        timer.effect = TIMER_OFF;
+        activeTimers &= ~(1 << channel);
+        constantSamples = 0;
+    }
+
+    TimerEffect SoundGenerator::getTimerEffect(int channel) const {
+        return timers[channel].effect;
+    }
+
+    double SoundGenerator::getTimerRate(int channel) const {
+        return timers[channel].effect == TIMER_OFF ? 0.0 : sampleRate * decimatorLeft.getFactor() / timers[channel].period;
+    }
+
+    void SoundGenerator::fireTimer(int channel) {
+        Timer& timer = timers[channel];
+        timer.high = !timer.high;
+        switch (timer.effect) {
+            case TIMER_SYNC_BUZZER:
+                ayumi_set_envelope_shape(ayumi.get(), ayumi->envelope_shape); // XXX Ayumi internals
+                break;
+            case TIMER_SYNC_SQUARE:
+                ayumi_set_envelope_shape(ayumi.get(), timer.high ? 0x0D : 0x09);
+                break;
+            case TIMER_SID:
+                if (!(activeStreams & (1 << channel))) {
+                    ayumi_set_volume(ayumi.get(), channel, timer.high ? levels[channel] : 0);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    // The data must stay valid while samples play from it, samples must be
+    // stopped before it changes.
+    void SoundGenerator::setSampleData(const uint8_t* data) {
+        sampleData = data;
+    }
+
+    // The sample starts at the given offset of the next process call, from
+    // start in the sample data.
+    void SoundGenerator::playSample(uint32_t offset, int channel, uint32_t start, uint32_t length, int rate, int attenuation) {
+        if (length == 0) {
+            return;
+        }
+        Stream& stream = pendingStreams[channel];
+        stream.start = start;
+        stream.length = length;
+        stream.position = 0;
+        stream.attenuation = attenuation;
+        stream.period = std::max(sampleRate * decimatorLeft.getFactor() / rate, 1.0);
+        pendingSamples |= 1 << channel;
+        pushEvent(offset, sampleEvent + channel, 0.0f);
+    }
+
+    // Samples stopped before their offset don't start.
+    void SoundGenerator::startSample(int channel) {
+        if (!(pendingSamples & (1 << channel))) {
+            return;
+        }
+        pendingSamples &= ~(1 << channel);
+        streams[channel] = pendingStreams[channel];
+        streams[channel].counter = 0.0;
+        if (!(activeStreams & (1 << channel))) {
+            activeStreams |= 1 << channel;
+            ayumi_set_mixer(ayumi.get(), channel, 1, 1, 0);
+        }
+        fireSample(channel);
+        constantSamples = 0;
+    }
+
+    // Gives the channel back to its registers.
+    void SoundGenerator::stopSample(int channel) {
+        pendingSamples &= ~(1 << channel);
+        if (!(activeStreams & (1 << channel))) {
+            return;
+        }
+        activeStreams &= ~(1 << channel);
+        applyRegisters(1 << (AY_LEVEL + channel), 0);
+    }
+
+    bool SoundGenerator::isPlayingSample(int channel) const {
+        return (activeStreams | pendingSamples) & (1 << channel);
+    }
+
+    void SoundGenerator::fireSample(int channel) {
+        Stream& stream = streams[channel];
+        if (stream.position == stream.length) {
+            stopSample(channel);
+            return;
+        }
+        ayumi_set_volume(ayumi.get(), channel, std::max(sampleData[stream.start + stream.position++] - stream.attenuation, 0));
+        stream.counter += stream.period;
+    }
+
+    void SoundGenerator::commit() {
+        committedRegisters = dirtyRegisters | scheduledRegisters;
+        scheduledRegisters = 0;
+        if (dirtyRegisters == 0 && dirtyPan == 0) {
+            return;
+        }
+        applyRegisters(dirtyRegisters, dirtyPan);
+        dirtyRegisters = 0;
+        dirtyPan = 0;
+    }
+
+    // Moves the pending writes to the given sample offset of the next
+    // process call instead of applying them at its start.
+    void SoundGenerator::scheduleCommit(uint32_t offset) {
+        for (int reg = 0; reg < AY_REGISTERS; reg++) {
+            if (dirtyRegisters & (1 << reg)) {
+                pushEvent(offset, reg, registers[reg]);
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            if (dirtyPan & (1 << i)) {
+                pushEvent(offset, panEvent + i, pan[i]);
+            }
+        }
+        scheduledRegisters |= dirtyRegisters;
+        dirtyRegisters = 0;
+        dirtyPan = 0;
+    }
+
+    void SoundGenerator::scheduleRegister(uint32_t offset, int reg, int value) {
+        pushEvent(offset, reg, value & registerMasks[reg]);
+    }
+
+    // Without room left the write falls back to the next commit.
+    void SoundGenerator::pushEvent(uint32_t offset, int reg, float value) {
+        if (events.size() == maxEvents) {
+            if (reg < AY_REGISTERS) {
+                setRegister(reg, value);
+            } else if (reg < sampleEvent) {
+                setPan(reg - panEvent, value);
+            } else {
+                startSample(reg - sampleEvent);
+            }
+            return;
+        }
+        auto position = std::upper_bound(events.begin(), events.end(), offset,
+                [](uint32_t offset, const RegisterEvent& event) { return offset < event.offset; });
+        events.insert(position, {offset, reg, value});
+    }
+
+    void SoundGenerator::applyRegisters(uint16_t mask, uint8_t panMask) {
+        for (int i = 0; i < 3; i++) {
+            if (mask & (3 << (AY_TONE_FINE + 2 * i))) {
+                ayumi_set_tone(ayumi.get(), i, registers[AY_TONE_FINE + 2 * i] | registers[AY_TONE_COARSE + 2 * i] << 8);
+            }
+            if (mask & (1 << AY_MIXER | 1 << (AY_LEVEL + i))) {
+                const int mixer = registers[AY_MIXER] >> i;
+                const int level = registers[AY_LEVEL + i];
+                levels[i] = level & 0x0F;
+                if (!(activeStreams & (1 << i))) {
+                    const bool sidLow = timers[i].effect == TIMER_SID && !timers[i].high;
+                    ayumi_set_mixer(ayumi.get(), i, mixer & 1, (mixer >> 3) & 1, level >> 4);
+                    ayumi_set_volume(ayumi.get(), i, sidLow ? 0 : levels[i]);
+                }
+            }
+            if (panMask & (1 << i)) {
+                ayumi_set_pan(ayumi.get(), i, pan[i], 1);
+            }
+        }
+        if (mask & (1 << AY_NOISE_PERIOD)) {
+            ayumi_set_noise(ayumi.get(), registers[AY_NOISE_PERIOD]);
+        }
+        if (mask & (1 << AY_ENVELOPE_FINE | 1 << AY_ENVELOPE_COARSE)) {
+            ayumi_set_envelope(ayumi.get(), registers[AY_ENVELOPE_FINE] | registers[AY_ENVELOPE_COARSE] << 8);
+        }
+        if (mask & (1 << AY_ENVELOPE_SHAPE)) {
+            ayumi_set_envelope_shape(ayumi.get(), registers[AY_ENVELOPE_SHAPE]);
+        }
+        registerWrites += std::bitset<AY_REGISTERS>(mask).count();
+        constantOutput = true;
+        for (int i = 0; i < 3; i++) {
+            const int mixer = registers[AY_MIXER] >> i;
+            const int level = registers[AY_LEVEL + i];
+            const bool toneOrNoise = (mixer & 9) != 9;
+            if ((level & 0x10) || ((level & 0x0F) && toneOrNoise)) {
+                constantOutput = false;
+            }
+        }
+        constantSamples = 0;
+    }
+
+    uint64_t SoundGenerator::getRegisterWrites() const {
+        return registerWrites;
+    }
+
+    uint16_t SoundGenerator::getCommittedRegisters() const {
+        return committedRegisters;
+    }
+
+    bool SoundGenerator::isIdle() const {
+        return constantOutput && activeTimers == 0 && activeStreams == 0 && constantSamples >= settleSamples;
+    }
+
+    void SoundGenerator::save(State& state) const {
+        state.chip = *ayumi;
+        state.emul = emul;
+        state.gain = gain;
+        state.clockRate = clockRate;
+        state.clockStep = clockStep;
+        state.removeDc = removeDc;
+        std::copy(std::begin(registers), std::end(registers), state.registers);
+        std::copy(std::begin(pan), std::end(pan), state.pan);
+        state.dirtyRegisters = dirtyRegisters;
+        state.committedRegisters = committedRegisters;
+        state.dirtyPan = dirtyPan;
+        state.registerWrites = registerWrites;
+        state.constantOutput = constantOutput;
+        state.constantSamples = constantSamples;
+        state.lastLeft = lastLeft;
+        state.lastRight = lastRight;
+        decimatorLeft.save(state.decimatorLeft);
+        decimatorRight.save(state.decimatorRight);
+        std::copy(events.begin(), events.end(), state.events);
+        state.eventCount = events.size();
+        state.scheduledRegisters = scheduledRegisters;
+        std::copy(std::begin(timers), std::end(timers), state.timers);
+        state.activeTimers = activeTimers;
+        std::copy(std::begin(levels), std::end(levels), state.levels);
+        std::copy(std::begin(streams), std::end(streams), state.streams);
+        std::copy(std::begin(pendingStreams), std::end(pendingStreams), state.pendingStreams);
+        state.activeStreams = activeStreams;
+        state.pendingSamples = pendingSamples;
+    }
+
+    // Both generators must run at the same sample rate.
+    void SoundGenerator::restore(const State& state) {
+        *ayumi = state.chip;
+        emul = state.emul;
+        ayumi->dac_table = emul == YM2149 ? YM_dac_table : AY_dac_table; // XXX Ayumi internals
+        gain = state.gain;
+        clockRate = state.clockRate;
+        clockStep = state.clockStep;
+        removeDc = state.removeDc;
+        std::copy(std::begin(state.registers), std::end(state.registers), registers);
+        std::copy(std::begin(state.pan), std::end(state.pan), pan);
+        dirtyRegisters = state.dirtyRegisters;
+        committedRegisters = state.committedRegisters;
+        dirtyPan = state.dirtyPan;
+        registerWrites = state.registerWrites;
+        constantOutput = state.constantOutput;
+        constantSamples = state.constantSamples;
+        lastLeft = state.lastLeft;
+        lastRight = state.lastRight;
+        centeredSamples = 0;
+        decimatorLeft.restore(state.decimatorLeft);
+        decimatorRight.restore(state.decimatorRight);
+        events.assign(state.events, state.events + state.eventCount);
+        scheduledRegisters = state.scheduledRegisters;
+        std::copy(std::begin(state.timers), std::end(state.timers), timers);
+        activeTimers = state.activeTimers;
+        std::copy(std::begin(state.levels), std::end(state.levels), levels);
+        std::copy(std::begin(state.streams), std::end(state.streams), streams);
+        std::copy(std::begin(state.pendingStreams), std::end(state.pendingStreams), pendingStreams);
+        activeStreams = state.activeStreams;
+        pendingSamples = state.pendingSamples;
+    }
+
     void SoundGenerator::process(float* left, float* right, const uint32_t size) {
-        for (int i = 0; i < size; i++) {
-            ayumi_process(&*ayumi, false);
-            if (removeDc) {
-                ayumi_remove_dc(&*ayumi);
+        run(left, right, size, 0);
+    }
+
+    // Advances the chip like process does without rendering, but for the
+    // blocks reaching past warmFrom which fill the decimators and the DC
+    // filter again.
+    void SoundGenerator::skip(const uint32_t size, const uint32_t warmFrom) {
+        run(nullptr, nullptr, size, warmFrom);
+    }
+
+    // Renders or skips up to each scheduled write in turn. Offsets of the
+    // writes left for later calls are moved back by the block size.
+    void SoundGenerator::run(float* left, float* right, const uint32_t size, const uint32_t warmFrom) {
+        uint32_t done = 0;
+        size_t next = 0;
+        while (done < size) {
+            while (next < events.size() && events[next].offset <= done) {
+                const RegisterEvent& event = events[next++];
+                if (event.reg < AY_REGISTERS) {
+                    registers[event.reg] = event.value;
+                    applyRegisters(1 << event.reg, 0);
+                } else if (event.reg < sampleEvent) {
+                    pan[event.reg - panEvent] = event.value;
+                    applyRegisters(0, 1 << (event.reg - panEvent));
+                } else {
+                    startSample(event.reg - sampleEvent);
+                }
+            }
+            const uint32_t end = next < events.size() ? std::min(events[next].offset, size) : size;
+            if (left != nullptr) {
+                render(left + done, right + done, end - done);
+            } else {
+                advance(end - done, warmFrom > done ? warmFrom - done : 0);
+            }
+            done = end;
+        }
+        events.erase(events.begin(), events.begin() + next);
+        for (auto& event : events) {
+            event.offset -= size;
+        }
+    }
+
+    void SoundGenerator::render(float* left, float* right, uint32_t size) {
+        if (isIdle()) {
+            std::fill(left, left + size, (float) lastLeft * gain);
+            std::fill(right, right + size, (float) lastRight * gain);
+            return;
+        }
+        uint32_t done = 0;
+        while (done < size) {
+            const int count = std::min(size - done, (uint32_t)Decimator::maxBlockSize);
+            renderBlock(left, right, count);
+            left += count;
+            right += count;
+            done += count;
+        }
+    }
+
+    const SoundGenerator::BlockKernel SoundGenerator::blockKernels[2][2] = {
+        {&SoundGenerator::decimateBlock<false, false>, &SoundGenerator::decimateBlock<false, true>},
+        {&SoundGenerator::decimateBlock<true, false>, &SoundGenerator::decimateBlock<true, true>}
+    };
+
+    // The chip picks its own loop for the emulation and pans, the
+    // decimation is picked here once the decimator histories hold nothing
+    // but centered output either.
+    void SoundGenerator::renderBlock(float* left, float* right, int count) {
+        const bool centered = ayumi_is_centered(ayumi.get());
+        if (activeTimers == 0 && activeStreams == 0) {
+            ayumi_oversample(ayumi.get(), decimatorLeft.getInput(), decimatorRight.getInput(), count * decimatorLeft.getFactor());
+        } else {
+            oversampleTimers(decimatorLeft.getInput(), decimatorRight.getInput(), count * decimatorLeft.getFactor());
+        }
+        const BlockKernel kernel = blockKernels[removeDc][centered && centeredSamples == Decimator::maxHistory];
+        (this->*kernel)(left, right, count);
+        centeredSamples = centered ? std::min(centeredSamples + count, Decimator::maxHistory) : 0;
+        lastLeft = outputLeft[count - 1];
+        lastRight = outputRight[count - 1];
+        if (constantOutput) {
+            constantSamples = std::min(constantSamples + count, settleSamples);
+        }
+    }
+
+    template <bool filterDc, bool centered>
+    void SoundGenerator::decimateBlock(float* left, float* right, int count) {
+        decimatorLeft.process(outputLeft, count);
+        if (centered) {
+            decimatorRight.follow(decimatorLeft);
+            std::copy(outputLeft, outputLeft + count, outputRight);
+        } else {
+            decimatorRight.process(outputRight, count);
+        }
+        for (int i = 0; i < count; i++) {
+            if (filterDc) {
+                ayumi->left = outputLeft[i];
+                ayumi->right = outputRight[i];
+                ayumi_remove_dc(ayumi.get());
+                outputLeft[i] = ayumi->left;
+                outputRight[i] = ayumi->right;
+            }
+            left[i] = (float) outputLeft[i] * gain;
+            right[i] = centered && !filterDc ? left[i] : (float) outputRight[i] * gain;
+        }
+    }
+
+    // Blocks are cut like render cuts them. The ones reaching past warmFrom
+    // are rendered and thrown away, the others only step the chip.
+    void SoundGenerator::advance(uint32_t size, uint32_t warmFrom) {
+        if (isIdle()) {
+            return;
+        }
+        float left[Decimator::maxBlockSize];
+        float right[Decimator::maxBlockSize];
+        uint32_t done = 0;
+        while (done < size) {
+            const int count = std::min(size - done, (uint32_t)Decimator::maxBlockSize);
+            if (done + count > warmFrom) {
+                renderBlock(left, right, count);
+                // Idle counts the skipped samples too, which the DC filter
+                // never saw.
+                if (removeDc && isIdle()) {
+                    settle(count);
+                }
+            } else {
+                skipBlock(count);
+            }
+            done += count;
+        }
+    }
+
+    void SoundGenerator::skipBlock(int count) {
+        if (activeTimers == 0 && activeStreams == 0) {
+            ayumi_skip(ayumi.get(), count * decimatorLeft.getFactor());
+        } else {
+            oversampleTimers(nullptr, nullptr, count * decimatorLeft.getFactor());
+        }
+        if (constantOutput) {
+            constantSamples = std::min(constantSamples + count, settleSamples);
+        }
+        // The skipped samples never reach the decimators.
+        centeredSamples = 0;
+        if (isIdle()) {
+            settle(count);
+        }
+    }
+
+    // Once idle the interpolators hold the chip level, so the decimators and
+    // the DC filter see it all along their history and lastLeft and
+    // lastRight come out as rendering the block would have left them.
+    void SoundGenerator::settle(int count) {
+        // XXX Ayumi internals
+        decimatorLeft.fill(ayumi->interpolator_left.c[0]);
+        decimatorRight.fill(ayumi->interpolator_right.c[0]);
+        decimatorLeft.process(outputLeft, count);
+        decimatorRight.process(outputRight, count);
+        lastLeft = outputLeft[count - 1];
+        lastRight = outputRight[count - 1];
+        if (removeDc) {
+            std::fill(std::begin(ayumi->dc_left.delay), std::end(ayumi->dc_left.delay), lastLeft);
+            std::fill(std::begin(ayumi->dc_right.delay), std::end(ayumi->dc_right.delay), lastRight);
+            ayumi->dc_left.sum = lastLeft * DC_FILTER_SIZE;
+            ayumi->dc_right.sum = lastRight * DC_FILTER_SIZE;
+            ayumi->left = lastLeft;
+            ayumi->right = lastRight;
+            ayumi_remove_dc(ayumi.get());
+            lastLeft = ayumi->left;
+            lastRight = ayumi->right;
+        }
+    }
+
+    // Oversamples in runs that end where a timer fires or a sample steps.
+    void SoundGenerator::oversampleTimers(double* left, double* right, int size) {
+        int done = 0;
+        while (done < size) {
+            double next = size - done;
+            for (int i = 0; i < 3; i++) {
+                if (activeTimers & (1 << i)) {
+                    next = std::min(next, timers[i].counter);
+                }
+                if (activeStreams & (1 << i)) {
+                    next = std::min(next, streams[i].counter);
+                }
+            }
+            const int count = std::max((int)std::ceil(next), 1);
+            if (left != nullptr) {
+                ayumi_oversample(ayumi.get(), left + done, right + done, count);
+            } else {
+                ayumi_skip(ayumi.get(), count);
+            }
+            done += count;
+            for (int i = 0; i < 3; i++) {
+                if (activeTimers & (1 << i)) {
+                    timers[i].counter -= count;
+                    while (timers[i].counter <= 0.0) {
+                        fireTimer(i);
+                        timers[i].counter += timers[i].period;
+                    }
+                }
+                if (activeStreams & (1 << i)) {
+                    streams[i].counter -= count;
+                    while (activeStreams & (1 << i) && streams[i].counter <= 0.0) {
+                        fireSample(i);
+                    }
+                }
             }
-            *left = (float) ayumi->left * gain;
-            *right = (float) ayumi->right * gain;
-            left++;
-            right++;
         }
     }
 }
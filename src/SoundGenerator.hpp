@@ -1,42 +1,220 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <vector>
+#include "Decimator.hpp"
 
 namespace AyMidi {
 
+    extern "C" {
+#include "ayumi.h"
+    }
+
     enum Emul {
         AY8910,
         YM2149
     };
 
+    enum AyRegister {
+        AY_TONE_FINE = 0, // Two registers per channel
+        AY_TONE_COARSE = 1,
+        AY_NOISE_PERIOD = 6,
+        AY_MIXER = 7,
+        AY_LEVEL = 8, // One register per channel
+        AY_ENVELOPE_FINE = 11,
+        AY_ENVELOPE_COARSE = 12,
+        AY_ENVELOPE_SHAPE = 13,
+        AY_REGISTERS = 14
+    };
+
+    // Register writes driven by a per channel timer, like the ones done
+    // from the Atari ST MFP timers.
+    enum TimerEffect {
+        TIMER_OFF,
+        TIMER_SYNC_BUZZER, // Restarts the envelope every period
+        TIMER_SYNC_SQUARE, // Alternates rising and falling envelopes
+        TIMER_SID // Toggles the channel level
+    };
+
     class SoundGenerator {
 
         private:
             const static Emul defaultEmul = YM2149;
-            std::shared_ptr<struct ayumi> ayumi;
+            // The frequency table covers pitchMin..pitchMax semitones in
+            // 1/pitchSteps steps.
+            constexpr static int pitchSteps = 64;
+            constexpr static int pitchMin = -96;
+            constexpr static int pitchMax = 192;
+            constexpr static int pitchTableSize = (pitchMax - pitchMin) * pitchSteps;
+            std::unique_ptr<struct ayumi> ayumi;
             Emul emul = defaultEmul;
-            float gain;
-            int clockRate;
+            float gain = 1.0f;
+            int clockRate = 0;
             double sampleRate;
+            const double* frequencies;
             double clockStep;
             bool removeDc = false;
-            int lastEnvShape = 0;
+            // Shadow of the chip registers, committed to ayumi once per tick.
+            uint8_t registers[AY_REGISTERS];
+            float pan[3];
+            uint16_t dirtyRegisters = 0;
+            uint16_t committedRegisters = 0;
+            uint8_t dirtyPan = 0;
+            uint64_t registerWrites = 0;
+            // Set while the registers hold every channel at a fixed level.
+            bool constantOutput = true;
+            int constantSamples = 0;
+            double lastLeft = 0.0;
+            double lastRight = 0.0;
+            // Output samples in a row rendered with both sides alike, up to
+            // the longest decimator history.
+            int centeredSamples = 0;
+            Decimator decimatorLeft;
+            Decimator decimatorRight;
+            double outputLeft[Decimator::maxBlockSize];
+            double outputRight[Decimator::maxBlockSize];
+            // Writes timed inside the next blocks, sorted by sample offset.
+            // Registers past AY_REGISTERS set the channel pans or start the
+            // pending samples.
+            constexpr static int panEvent = AY_REGISTERS;
+            constexpr static int sampleEvent = AY_REGISTERS + 3;
+            struct RegisterEvent {
+                uint32_t offset;
+                int reg;
+                float value;
+            };
+            std::vector<RegisterEvent> events;
+            uint16_t scheduledRegisters = 0;
+            // Counters run at the oversampled rate.
+            struct Timer {
+                TimerEffect effect = TIMER_OFF;
+                double period = 0.0;
+                double counter = 0.0;
+                bool high = true;
+            };
+            Timer timers[3];
+            uint8_t activeTimers = 0;
+            uint8_t levels[3] = {0, 0, 0};
+            // 4 bit samples streamed to the level register, clocked like the
+            // timers. They take the channel over while playing. Streams start
+            // at an offset into the sample data.
+            const uint8_t* sampleData = nullptr;
+            struct Stream {
+                uint32_t start = 0;
+                uint32_t length = 0;
+                uint32_t position = 0;
+                int attenuation = 0;
+                double period = 0.0;
+                double counter = 0.0;
+            };
+            Stream streams[3];
+            Stream pendingStreams[3];
+            uint8_t activeStreams = 0;
+            uint8_t pendingSamples = 0;
+            // Decimation and output of a block, built for each DC removal
+            // setting and for the right side following the left one.
+            typedef void (SoundGenerator::*BlockKernel)(float* left, float* right, int count);
+            static const BlockKernel blockKernels[2][2];
+
+            static const std::vector<double>& getFrequencies();
+            double pitchToFrequency(float pitch) const;
+            void pushEvent(uint32_t offset, int reg, float value);
+            void applyRegisters(uint16_t mask, uint8_t panMask);
+            void run(float* left, float* right, uint32_t size, uint32_t warmFrom);
+            void render(float* left, float* right, uint32_t size);
+            void renderBlock(float* left, float* right, int count);
+            template <bool filterDc, bool centered>
+            void decimateBlock(float* left, float* right, int count);
+            void advance(uint32_t size, uint32_t warmFrom);
+            void skipBlock(int count);
+            void settle(int count);
+            void oversampleTimers(double* left, double* right, int size);
+            void fireTimer(int channel);
+            void stopTimer(int channel);
+            void startSample(int channel);
+            void fireSample(int channel);
 
         public:
+            constexpr static int maxEvents = 256;
+
+            // Everything but the sample rate, sample data and scratch buffers.
+            // Streams only hold offsets into the sample data.
+            struct State {
+                struct ayumi chip;
+                Emul emul;
+                float gain;
+                int clockRate;
+                double clockStep;
+                bool removeDc;
+                uint8_t registers[AY_REGISTERS];
+                float pan[3];
+                uint16_t dirtyRegisters;
+                uint16_t committedRegisters;
+                uint8_t dirtyPan;
+                uint64_t registerWrites;
+                bool constantOutput;
+                int constantSamples;
+                double lastLeft;
+                double lastRight;
+                Decimator::State decimatorLeft;
+                Decimator::State decimatorRight;
+                RegisterEvent events[maxEvents];
+                int eventCount;
+                uint16_t scheduledRegisters;
+                Timer timers[3];
+                uint8_t activeTimers;
+                uint8_t levels[3];
+                Stream streams[3];
+                Stream pendingStreams[3];
+                uint8_t activeStreams;
+                uint8_t pendingSamples;
+            };
+
             SoundGenerator(double sampleRate, int clockRate);
-            std::shared_ptr<struct ayumi> getAyumi();
+            ~SoundGenerator();
+            struct ayumi* getAyumi();
             int getSampleRate();
             int setClockRate(int clockRate);
             int getClockRate() const;
             void setEmul(Emul emul);
+            Emul getEmul() const;
+            void setQuality(Quality quality);
+            Quality getQuality() const;
             void enableRemoveDc(bool enable = true);
+            bool isRemovingDc() const;
             void setGain(float gain);
-            int freqToSquarePeriod(const double freq) const;
-            int freqToBuzzerPeriod(const double freq) const;
+            float getGain() const;
+            int pitchToTonePeriod(float pitch) const;
+            int pitchToEnvelopePeriod(float pitch) const;
+            void setRegister(int reg, int value);
+            int getRegister(int reg) const;
+            void setTonePeriod(int channel, int period);
+            void enableTone(int channel, bool enable);
+            void enableNoise(int channel, bool enable);
+            void enableEnvelope(int channel, bool enable);
+            void setLevel(int channel, int level);
+            void setPan(int channel, float pan);
             void setNoisePeriod(int period);
             void setEnvelopePeriod(int period);
-            void setEnvelopeFreq(int freq);
             void setEnvelopeShape(int shape);
+            void setTimer(int channel, TimerEffect effect, float pitch);
+            TimerEffect getTimerEffect(int channel) const;
+            // Times per second the timer fires, 0 while it is off.
+            double getTimerRate(int channel) const;
+            void setSampleData(const uint8_t* data);
+            void playSample(uint32_t offset, int channel, uint32_t start, uint32_t length, int rate, int attenuation);
+            void stopSample(int channel);
+            bool isPlayingSample(int channel) const;
+            void commit();
+            void scheduleCommit(uint32_t offset);
+            void scheduleRegister(uint32_t offset, int reg, int value);
+            uint64_t getRegisterWrites() const;
+            uint16_t getCommittedRegisters() const;
+            bool isIdle() const;
+            void save(State& state) const;
+            void restore(const State& state);
             void process(float *left, float *right, const uint32_t size);
+            void skip(const uint32_t size, const uint32_t warmFrom);
     };
 }
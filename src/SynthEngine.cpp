@@ -1,35 +1,417 @@
 #include <algorithm>
 #include <cmath>
+#include <iterator>
 #include "SynthEngine.hpp"
-#include "DistrhoUtils.hpp"
 
 namespace AyMidi {
 
-    SynthEngine::SynthEngine(std::shared_ptr<SoundGenerator> sg) : sg(sg) {
-        vp = std::make_shared<VoiceProcessor>(sg);
-        vp->setOmniMode(true);
-        vp->setMonoMode(false);
+    namespace {
+
+        typedef void (Channel::*ControlHandler)(int value);
+
+        // Channel controllers by number, channel mode messages are left to
+        // the engine.
+        struct ControlTable {
+            ControlHandler handlers[128] = {};
+
+            ControlTable() {
+                handlers[MIDI_CTL_MSB_MODWHEEL] = &Channel::msgModWheel;
+                handlers[MIDI_CTL_MSB_PAN] = &Channel::msgPan;
+                handlers[MIDI_CTL_MSB_MAIN_VOLUME] = &Channel::msgVolume;
+                handlers[MIDI_CTL_SC7_VIBRATO_RATE] = &Channel::msgVibratoRate;
+                handlers[MIDI_CTL_SC8_VIBRATO_DEPTH] = &Channel::msgVibratoDepth;
+                handlers[MIDI_CTL_SC9_VIBRATO_DELAY] = &Channel::msgVibratoDelay;
+                handlers[MIDI_CTL_SC10_VIBRATO_WAVE] = &Channel::msgVibratoWaveform;
+                handlers[MIDI_CTL_PORTAMENTO] = &Channel::msgPortamento;
+                handlers[MIDI_CTL_MSB_PORTAMENTO_TIME] = &Channel::msgPortamentoTime;
+                handlers[MIDI_CTL_PORTAMENTO_CONTROL] = &Channel::msgPortamentoControl;
+                /* AY/YM Effects */
+                handlers[MIDI_CTL_AY_NOISE_PERIOD] = &Channel::msgNoisePeriod;
+                handlers[MIDI_CTL_AY_BUZZER_DETUNE] = &Channel::msgBuzzerDetune;
+                handlers[MIDI_CTL_AY_SQUARE_DETUNE] = &Channel::msgSquareDetune;
+                handlers[MIDI_CTL_AY_ATTACK_PITCH] = &Channel::msgAttackPitch;
+                handlers[MIDI_CTL_AY_ATTACK] = &Channel::msgAttack;
+                handlers[MIDI_CTL_AY_HOLD] = &Channel::msgHold;
+                handlers[MIDI_CTL_AY_DECAY] = &Channel::msgDecay;
+                handlers[MIDI_CTL_AY_SUSTAIN] = &Channel::msgSustain;
+                handlers[MIDI_CTL_AY_RELEASE] = &Channel::msgRelease;
+                handlers[MIDI_CTL_AY_ARPEGGIO_RATE] = &Channel::msgArpeggioRate;
+                handlers[MIDI_CTL_AY_TIMER_EFFECT] = &Channel::msgTimerEffect;
+                handlers[MIDI_CTL_AY_TIMER_DETUNE] = &Channel::msgTimerDetune;
+            }
+        };
+
+        const ControlTable controls;
+    }
+
+    static_assert(RegisterFrame::maxChips == SynthEngine::maxChips, "RegisterFrame must hold every chip");
+    static_assert(VoiceProcessor::maxVoices == SynthEngine::maxChips * VoiceProcessor::voicesPerChip, "State must hold every voice");
+
+    // The workers are started here, as chips are added on the audio thread.
+    // Without them every chip renders on the calling thread.
+    SynthEngine::SynthEngine(double sampleRate, int clockRate, bool parallel) :
+        sgs(makeChips(sampleRate, clockRate)),
+        vp(sgs)
+    {
+        if (parallel) {
+            const int threads = std::min((int)std::thread::hardware_concurrency(), maxChips) - 1;
+            if (threads > 0) {
+                workerPool = std::make_unique<WorkerPool>(threads);
+            }
+        }
+        currentDrumKit = getDefaultDrumKit();
+        for (auto& sg : sgs) {
+            sg->setSampleData(currentDrumKit->getData());
+        }
+        vp.setOmniMode(true);
+        vp.setMonoMode(false);
 
         for (int index = 0; index < 16; index++) {
-            channels[index] = std::make_unique<Channel>(vp, index);
+            channels[index] = std::make_unique<Channel>(vp, notePool, index);
         }
 
         baseChannel = 0;
         lastChannel = 0;
+        monoChannels = 0;
 
+        setChips(1);
         setUpdateRate(50);
+        midiEvents.reserve(maxMidiEvents);
+        settings.reserve(commands.getCapacity());
+    }
+
+    std::vector<std::unique_ptr<SoundGenerator>> SynthEngine::makeChips(double sampleRate, int clockRate) {
+        std::vector<std::unique_ptr<SoundGenerator>> sgs;
+        for (int i = 0; i < maxChips; i++) {
+            sgs.push_back(std::make_unique<SoundGenerator>(sampleRate, clockRate));
+        }
+        return sgs;
+    }
+
+    void SynthEngine::setChips(int count) {
+        stopDrums();
+        chips = std::max(1, std::min(count, maxChips));
+        vp.setChips(chips);
+        for (auto& sg : sgs) {
+            sg->commit();
+        }
+        updateLastChannel();
+    }
+
+    int SynthEngine::getChips() const {
+        return chips;
+    }
+
+    void SynthEngine::setGain(float gain) {
+        for (auto& sg : sgs) {
+            sg->setGain(gain);
+        }
+    }
+
+    void SynthEngine::setClockRate(int clockRate) {
+        for (auto& sg : sgs) {
+            sg->setClockRate(clockRate);
+        }
     }
 
+    void SynthEngine::setEmul(Emul emul) {
+        for (auto& sg : sgs) {
+            sg->setEmul(emul);
+        }
+    }
+
+    void SynthEngine::setQuality(Quality quality) {
+        for (auto& sg : sgs) {
+            sg->setQuality(quality);
+        }
+    }
+
+    void SynthEngine::enableRemoveDc(bool enable) {
+        for (auto& sg : sgs) {
+            sg->enableRemoveDc(enable);
+        }
+    }
+
+    // Keeps the position within the tick, so changing the rate doesn't
+    // restart it.
     void SynthEngine::setUpdateRate(int rate) {
+        const int period = std::round((float)sgs[0]->getSampleRate() / rate);
+        updateCounter = updatePeriod > 0 ? (int64_t)updateCounter * period / updatePeriod : 0;
         updateRate = rate;
-        updatePeriod = std::round((float)sg->getSampleRate() / rate);
-        updateCounter = 0;
+        updatePeriod = period;
     }
 
     void SynthEngine::setBasicChannel(int nChannel) {
         baseChannel = nChannel;
     }
 
+    uint64_t SynthEngine::getRegisterWrites() const {
+        uint64_t writes = 0;
+        for (auto& sg : sgs) {
+            writes += sg->getRegisterWrites();
+        }
+        return writes;
+    }
+
+    // Control ticks run since the engine was created.
+    uint32_t SynthEngine::getTicks() const {
+        return tick;
+    }
+
+    int SynthEngine::getActiveNotes() const {
+        return notePool.getUsed();
+    }
+
+    uint64_t SynthEngine::getVoiceSteals() const {
+        return vp.getSteals();
+    }
+
+    // The log must outlive its use by the audio thread, callers clear it and
+    // wait for the current block to finish before deleting it.
+    void SynthEngine::setRegisterLog(RegisterLog* log) {
+        registerLog.store(log, std::memory_order_release);
+    }
+
+    // No kit plays the built-in one. Kits set before stay in use until the
+    // audio thread picks this one up.
+    void SynthEngine::setDrumKit(const DrumKit* kit) {
+        drumKit.store(kit, std::memory_order_release);
+    }
+
+    // Once this returns the last kit set, the ones before it can be freed.
+    const DrumKit* SynthEngine::getPickedDrumKit() const {
+        return pickedDrumKit.load(std::memory_order_acquire);
+    }
+
+    // Messages on the drum channel play digidrums, -1 disables it.
+    void SynthEngine::setDrumChannel(int channel) {
+        drumChannel = channel;
+    }
+
+    // Changes a setting at the given offset in the next block, from any
+    // thread, the audio one included. Returns false when the queue is full
+    // and the change was dropped.
+    bool SynthEngine::postSetting(Setting setting, float value, uint32_t offset) {
+        if (!commands.push({offset, setting, value})) {
+            droppedSettings.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Settings dropped since the engine was created.
+    uint32_t SynthEngine::getDroppedSettings() const {
+        return droppedSettings.load(std::memory_order_relaxed);
+    }
+
+    void SynthEngine::save(State& state) const {
+        state.sampleRate = sgs[0]->getSampleRate();
+        for (int i = 0; i < maxChips; i++) {
+            sgs[i]->save(state.chips[i]);
+        }
+        vp.save(state.voices, notePool);
+        notePool.save(state.notes, vp);
+        for (int i = 0; i < 16; i++) {
+            channels[i]->save(state.channels[i]);
+        }
+        state.activeChannels = activeChannels;
+        state.tick = tick;
+        std::copy(midiEvents.begin(), midiEvents.end(), state.midiEvents);
+        state.midiEventCount = midiEvents.size();
+        std::copy(std::begin(drumSlots), std::end(drumSlots), state.drumSlots);
+        state.drumAge = drumAge;
+        state.drumKitId = currentDrumKit->getId();
+        state.drumChannel = drumChannel;
+        state.chipCount = chips;
+        state.updateRate = updateRate;
+        state.updatePeriod = updatePeriod;
+        state.updateCounter = updateCounter;
+        state.baseChannel = baseChannel;
+        state.lastChannel = lastChannel;
+        state.monoChannels = monoChannels;
+    }
+
+    // Returns false, leaving the engine untouched, when the sample rates
+    // differ. Drums started from another kit than the current one are
+    // stopped.
+    bool SynthEngine::restore(const State& state) {
+        if (state.sampleRate != sgs[0]->getSampleRate()) {
+            return false;
+        }
+        // Taken first, so that only a kit differing from the saved one stops
+        // the restored drums.
+        getDrumKit();
+        for (int i = 0; i < maxChips; i++) {
+            sgs[i]->restore(state.chips[i]);
+        }
+        ChannelData* params[16];
+        for (int i = 0; i < 16; i++) {
+            params[i] = channels[i]->getParams();
+        }
+        vp.restore(state.voices, notePool);
+        notePool.restore(state.notes, vp, params);
+        for (int i = 0; i < 16; i++) {
+            channels[i]->restore(state.channels[i]);
+        }
+        activeChannels = state.activeChannels;
+        tick = state.tick;
+        midiEvents.assign(state.midiEvents, state.midiEvents + state.midiEventCount);
+        std::copy(std::begin(state.drumSlots), std::end(state.drumSlots), drumSlots);
+        drumAge = state.drumAge;
+        drumChannel = state.drumChannel;
+        chips = state.chipCount;
+        updateRate = state.updateRate;
+        updatePeriod = state.updatePeriod;
+        updateCounter = state.updateCounter;
+        baseChannel = state.baseChannel;
+        lastChannel = state.lastChannel;
+        monoChannels = state.monoChannels;
+        if (state.drumKitId != currentDrumKit->getId()) {
+            stopDrums();
+        }
+        return true;
+    }
+
+    // Hosts send every parameter again now and then. Values already in
+    // effect are skipped, as some setters reset the decimators or stop the
+    // drums.
+    void SynthEngine::applySetting(const Command& command) {
+        switch (command.id) {
+            case SETTING_GAIN:
+                if (command.value != sgs[0]->getGain()) {
+                    setGain(command.value);
+                }
+                break;
+            case SETTING_CLOCK_RATE:
+                if ((int)command.value != sgs[0]->getClockRate()) {
+                    setClockRate((int)command.value);
+                }
+                break;
+            case SETTING_EMUL: {
+                const Emul emul = command.value == 1.0f ? YM2149 : AY8910;
+                if (emul != sgs[0]->getEmul()) {
+                    setEmul(emul);
+                }
+                break;
+            }
+            case SETTING_QUALITY:
+                if ((Quality)(int)command.value != sgs[0]->getQuality()) {
+                    setQuality((Quality)(int)command.value);
+                }
+                break;
+            case SETTING_UPDATE_RATE:
+                if ((int)command.value != updateRate) {
+                    setUpdateRate((int)command.value);
+                }
+                break;
+            case SETTING_BASIC_CHANNEL:
+                if ((int)command.value != baseChannel) {
+                    setBasicChannel((int)command.value);
+                }
+                break;
+            case SETTING_CHIPS:
+                if (std::max(1, std::min((int)command.value, maxChips)) != chips) {
+                    setChips((int)command.value);
+                }
+                break;
+            case SETTING_DRUM_CHANNEL:
+                if ((int)command.value != drumChannel) {
+                    setDrumChannel((int)command.value);
+                }
+                break;
+        }
+    }
+
+    // Shared by every engine, so states carry over with the drums playing.
+    const DrumKit* SynthEngine::getDefaultDrumKit() {
+        static const DrumKit kit = [] {
+            DrumKit kit;
+            kit.buildDefault();
+            return kit;
+        }();
+        return &kit;
+    }
+
+    const DrumKit* SynthEngine::getDrumKit() {
+        const DrumKit* kit = drumKit.load(std::memory_order_acquire);
+        if (kit != pickedDrumKit.load(std::memory_order_relaxed)) {
+            pickedDrumKit.store(kit, std::memory_order_release);
+        }
+        if (kit == nullptr) {
+            kit = getDefaultDrumKit();
+        }
+        if (kit != currentDrumKit) {
+            stopDrums();
+            currentDrumKit = kit;
+            for (auto& sg : sgs) {
+                sg->setSampleData(kit->getData());
+            }
+        }
+        return kit;
+    }
+
+    // Takes a free slot, then the one playing the same key, then the oldest.
+    // Velocity lowers the levels in steps of about 3 dB.
+    void SynthEngine::playDrum(int key, int velocity, uint32_t offset) {
+        const DrumKit* kit = getDrumKit();
+        const DrumKit::Drum* drum = kit->getDrum(key);
+        if (drum == nullptr || velocity == 0) {
+            return;
+        }
+        int slot = -1;
+        for (int i = 0; i < maxDrums && slot < 0; i++) {
+            if (!sgs[i % chips]->isPlayingSample(2 - i / chips)) {
+                slot = i;
+            }
+        }
+        for (int i = 0; i < maxDrums && slot < 0; i++) {
+            if (drumSlots[i].key == key) {
+                slot = i;
+            }
+        }
+        if (slot < 0) {
+            slot = 0;
+            for (int i = 1; i < maxDrums; i++) {
+                if (drumAge - drumSlots[i].age > drumAge - drumSlots[slot].age) {
+                    slot = i;
+                }
+            }
+        }
+        drumSlots[slot].key = key;
+        drumSlots[slot].age = drumAge++;
+        const int attenuation = std::round(-20.0f * std::log10(velocity / 127.0f) / 3.0f);
+        sgs[slot % chips]->playSample(offset, 2 - slot / chips, drum->offset, drum->length, drum->rate, attenuation);
+    }
+
+    void SynthEngine::stopDrums() {
+        for (auto& sg : sgs) {
+            for (int channel = 0; channel < 3; channel++) {
+                sg->stopSample(channel);
+            }
+        }
+        for (auto& slot : drumSlots) {
+            slot.key = -1;
+        }
+    }
+
+    bool SynthEngine::isIdle() const {
+        for (int chip = 0; chip < chips; chip++) {
+            if (!sgs[chip]->isIdle()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void SynthEngine::updateLastChannel() {
+        if (vp.getMonoMode()) {
+            int count = monoChannels == 0 ? vp.getVoiceCount() : monoChannels;
+            lastChannel = std::min(baseChannel + count - 1, 15);
+        } else {
+            lastChannel = baseChannel;
+        }
+    }
+
     void SynthEngine::allNotesOff() {
         for (int i = 0; i < 16; i++) {
             channels[i]->msgAllNotesOff();
@@ -45,23 +427,75 @@ namespace AyMidi {
     }
 
     void SynthEngine::midiSend(const uint8_t* message) {
+        dispatch(message, 0);
+    }
+
+    // Queues a message for the given sample of the next process call. A full
+    // queue handles it right away.
+    void SynthEngine::midiSend(const uint8_t* message, uint32_t offset) {
+        if (midiEvents.size() == maxMidiEvents) {
+            dispatch(message, offset);
+            return;
+        }
+        auto position = std::upper_bound(midiEvents.begin(), midiEvents.end(), offset,
+                [](uint32_t offset, const MidiEvent& event) { return offset < event.offset; });
+        midiEvents.insert(position, {offset, {message[0], message[1], message[2]}});
+    }
+
+    // Queues a whole block of messages. Those in offset order after the
+    // queued ones are appended as they come.
+    void SynthEngine::midiSend(const MidiEvent* events, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (midiEvents.size() < maxMidiEvents && (midiEvents.empty() || midiEvents.back().offset <= events[i].offset)) {
+                midiEvents.push_back(events[i]);
+            } else {
+                midiSend(events[i].message, events[i].offset);
+            }
+        }
+    }
+
+    void SynthEngine::startNote(Note* note, uint32_t offset) {
+        if (note == nullptr) {
+            return;
+        }
+        activeChannels |= 1 << note->channelId;
+        if (note->getVoice() == nullptr) {
+            return;
+        }
+        note->start(updateRate);
+        for (int chip = 0; chip < chips; chip++) {
+            sgs[chip]->scheduleCommit(offset);
+        }
+    }
+
+    // The offset is where note ons are heard within the next render.
+    void SynthEngine::dispatch(const uint8_t* message, uint32_t offset) {
         const uint8_t status = message[0];
         const int index = status & 0xF;
 
-        if (!vp->getOmniMode()) {
+        if (index == drumChannel && status < MIDI_MSG_SYSTEM_EXCLUSIVE) {
+            if (getMidiMsgStatus(message) == MIDI_MSG_NOTE_ON) {
+                playDrum(message[1], message[2], offset);
+            } else if (getMidiMsgStatus(message) == MIDI_MSG_CONTROL && message[1] == MIDI_CTL_ALL_SOUNDS_OFF) {
+                stopDrums();
+            }
+            return;
+        }
+
+        if (!vp.getOmniMode()) {
             if (index < baseChannel || index > lastChannel) {
                 return;
             }
         }
 
-        Channel* channel = &*channels[index];
+        Channel* channel = channels[index].get();
 
         switch (getMidiMsgStatus(message)) {
             case MIDI_MSG_NOTE_OFF:
                 channel->msgNoteOff(message[1], message[2]);
                 break;
             case MIDI_MSG_NOTE_ON:
-                channel->msgNoteOn(message[1], message[2]);
+                startNote(channel->msgNoteOn(message[1], message[2]), offset);
                 break;
             case MIDI_MSG_KEY_PRESSURE:
                 channel->msgKeyPressure(message[1], message[2]);
@@ -79,6 +513,10 @@ namespace AyMidi {
                 channel->msgReset();
                 break;
             case MIDI_MSG_CONTROL:
+                if (controls.handlers[message[1] & 0x7F] != nullptr) {
+                    (channel->*controls.handlers[message[1] & 0x7F])(message[2] & 0x7F);
+                    break;
+                }
                 if (index != baseChannel && message[1] >= MIDI_CTL_ALL_SOUNDS_OFF) {
                     break;
                 }
@@ -90,90 +528,30 @@ namespace AyMidi {
                         for (int i = 0; i < 16; i++) {
                             channels[i]->msgAllSoundsOff();
                         }
+                        stopDrums();
                         break;
                     case MIDI_CTL_ALL_NOTES_OFF:
                         allNotesOff();
                         break;
                     case MIDI_CTL_OMNI_MODE_ON:
-                        vp->setOmniMode(true);
+                        vp.setOmniMode(true);
                         allNotesOff();
                         break;
                     case MIDI_CTL_OMNI_MODE_OFF:
-                        vp->setOmniMode(false);
+                        vp.setOmniMode(false);
                         allNotesOff();
                         break;
                     case MIDI_CTL_POLY_MODE_ON:
-                        vp->setMonoMode(false);
-                        lastChannel = baseChannel;
+                        vp.setMonoMode(false);
+                        updateLastChannel();
                         allNotesOff();
                         break;
                     case MIDI_CTL_MONO_MODE_ON:
-                        vp->setMonoMode(true);
-                        if (message[2] == 0) {
-                            lastChannel = std::min(baseChannel + 2, 15);
-                        } else {
-                            lastChannel = std::min(baseChannel + message[2] - 1, 15);
-                        }
+                        vp.setMonoMode(true);
+                        monoChannels = message[2];
+                        updateLastChannel();
                         allNotesOff();
                         break;
-                    case MIDI_CTL_MSB_MODWHEEL:
-                        channel->msgModWheel(message[2]);
-                        break;
-                    case MIDI_CTL_MSB_PAN:
-                        channel->msgPan(message[2]);
-                        break;
-                    case MIDI_CTL_MSB_MAIN_VOLUME:
-                        channel->msgVolume(message[2]);
-                        break;
-                    case MIDI_CTL_SC7_VIBRATO_RATE:
-                        channel->msgVibratoRate(message[2]);
-                        break;
-                    case MIDI_CTL_SC8_VIBRATO_DEPTH:
-                        channel->msgVibratoDepth(message[2]);
-                        break;
-                    case MIDI_CTL_SC9_VIBRATO_DELAY:
-                        channel->msgVibratoDelay(message[2]);
-                        break;
-                    case MIDI_CTL_PORTAMENTO:
-                        channel->msgPortamento(message[2]);
-                        break;
-                    case MIDI_CTL_MSB_PORTAMENTO_TIME:
-                        channel->msgPortamentoTime(message[2]);
-                        break;
-                    case MIDI_CTL_PORTAMENTO_CONTROL:
-                        channel->msgPortamentoControl(message[2]);
-                        break;
-                    /* AY/YM Effects */
-                    case MIDI_CTL_AY_NOISE_PERIOD:
-                        channel->msgNoisePeriod(message[2]);
-                        break;
-                    case MIDI_CTL_AY_BUZZER_DETUNE:
-                        channel->msgBuzzerDetune(message[2]);
-                        break;
-                    case MIDI_CTL_AY_SQUARE_DETUNE:
-                        channel->msgSquareDetune(message[2]);
-                        break;
-                    case MIDI_CTL_AY_ATTACK_PITCH:
-                        channel->msgAttackPitch(message[2]);
-                        break;
-                    case MIDI_CTL_AY_ATTACK:
-                        channel->msgAttack(message[2]);
-                        break;
-                    case MIDI_CTL_AY_HOLD:
-                        channel->msgHold(message[2]);
-                        break;
-                    case MIDI_CTL_AY_DECAY:
-                        channel->msgDecay(message[2]);
-                        break;
-                    case MIDI_CTL_AY_SUSTAIN:
-                        channel->msgSustain(message[2]);
-                        break;
-                    case MIDI_CTL_AY_RELEASE:
-                        channel->msgRelease(message[2]);
-                        break;
-                    case MIDI_CTL_AY_ARPEGGIO_RATE:
-                        channel->msgArpeggioRate(message[2]);
-                        break;
                     default:
                         break;
                 }
@@ -183,30 +561,164 @@ namespace AyMidi {
     }
 
     void SynthEngine::process(float *left, float *right, const uint32_t size) {
-        int reminder = size;
-        while (reminder > 0) {
+        run(left, right, size, 0);
+    }
+
+    // Runs the block like process, queued messages and settings included,
+    // but only renders its last warmSamples so that the next process call
+    // sounds as if this one had rendered everything. Consecutive skips only
+    // need the last one warmed.
+    void SynthEngine::skip(const uint32_t size, const bool warm) {
+        uint32_t warmFrom = size;
+        if (warm) {
+            const uint32_t samples = warmSamples + (sgs[0]->isRemovingDc() ? DC_FILTER_SIZE : 0);
+            warmFrom = size > samples ? size - samples : 0;
+        }
+        run(nullptr, nullptr, size, warmFrom);
+    }
+
+    void SynthEngine::skip(const uint32_t size, const MidiEvent* events, uint32_t count) {
+        midiSend(events, count);
+        skip(size);
+    }
+
+    // Ticks keep their cadence. Queued messages change the state at the start
+    // of the tick segment holding them, or before the tick when they fall on
+    // it, but note ons are heard at their own sample. Posted settings split
+    // the segments and apply at their own sample. Skips without output.
+    void SynthEngine::run(float *left, float *right, const uint32_t size, const uint32_t warmFrom) {
+        getDrumKit();
+        Command command;
+        while (commands.pop(command)) {
+            auto position = std::upper_bound(settings.begin(), settings.end(), command.offset, [](uint32_t offset, const Command& setting) {
+                return offset < setting.offset;
+            });
+            settings.insert(position, command);
+        }
+        uint32_t done = 0;
+        size_t next = 0;
+        size_t nextSetting = 0;
+        while (true) {
+            while (nextSetting < settings.size() && (settings[nextSetting].offset <= done || done == size)) {
+                applySetting(settings[nextSetting++]);
+            }
+            while (next < midiEvents.size() && (midiEvents[next].offset <= done || done == size)) {
+                dispatch(midiEvents[next++].message, 0);
+            }
+            if (done == size) {
+                break;
+            }
             if (updateCounter >= updatePeriod) {
                 updateCounter -= updatePeriod;
                 update();
             }
-            int nextUpdate = updatePeriod - updateCounter;
-            if (nextUpdate >= reminder) {
-                updateCounter = updateCounter + reminder;
-                sg->process(left, right, reminder);
-                return;
+            uint32_t count = std::min<uint32_t>(updatePeriod - updateCounter, size - done);
+            if (nextSetting < settings.size()) {
+                count = std::min(count, settings[nextSetting].offset - done);
+            }
+            while (next < midiEvents.size() && midiEvents[next].offset < done + count) {
+                const MidiEvent& event = midiEvents[next++];
+                dispatch(event.message, event.offset - done);
+            }
+            if (left != nullptr) {
+                render(left + done, right + done, count);
+            } else {
+                skipChips(count, warmFrom > done ? warmFrom - done : 0);
+            }
+            updateCounter += count;
+            done += count;
+        }
+        midiEvents.clear();
+        settings.clear();
+    }
+
+    void SynthEngine::render(float *left, float *right, const uint32_t size) {
+        if (chips == 1) {
+            sgs[0]->process(left, right, size);
+            return;
+        }
+        uint32_t done = 0;
+        while (done < size) {
+            const int count = std::min(size - done, (uint32_t)Decimator::maxBlockSize);
+            auto renderChip = [this, count](int chip) {
+                sgs[chip]->process(chipLeft[chip], chipRight[chip], count);
+            };
+            if (chips >= parallelChips && workerPool != nullptr && count >= parallelBlockSize && !isIdle()) {
+                workerPool->run(chips, renderChip);
+            } else {
+                for (int chip = 0; chip < chips; chip++) {
+                    renderChip(chip);
+                }
+            }
+            // Summed in chip order so the result doesn't depend on scheduling.
+            for (int i = 0; i < count; i++) {
+                float l = chipLeft[0][i];
+                float r = chipRight[0][i];
+                for (int chip = 1; chip < chips; chip++) {
+                    l += chipLeft[chip][i];
+                    r += chipRight[chip][i];
+                }
+                left[i] = l;
+                right[i] = r;
+            }
+            left += count;
+            right += count;
+            done += count;
+        }
+    }
+
+    // Cut in blocks like render so the chips warm up the same samples.
+    void SynthEngine::skipChips(const uint32_t size, const uint32_t warmFrom) {
+        if (chips == 1) {
+            sgs[0]->skip(size, warmFrom);
+            return;
+        }
+        for (uint32_t done = 0; done < size; done += Decimator::maxBlockSize) {
+            const uint32_t count = std::min(size - done, (uint32_t)Decimator::maxBlockSize);
+            for (int chip = 0; chip < chips; chip++) {
+                sgs[chip]->skip(count, warmFrom > done ? warmFrom - done : 0);
             }
-            sg->process(left, right, nextUpdate);
-            left += nextUpdate;
-            right += nextUpdate;
-            reminder -= nextUpdate;
-            updateCounter += nextUpdate;
         }
     }
 
     void SynthEngine::update() {
-        for (int index = 0; index < 16; index++) {
-            channels[index]->update(updateRate);
+        int index = 0;
+        for (uint16_t active = activeChannels; active != 0; active >>= 1, index++) {
+            if (active & 1) {
+                channels[index]->update(updateRate);
+                if (!channels[index]->isActive()) {
+                    activeChannels &= ~(1 << index);
+                }
+            }
+        }
+        vp.update(updateRate);
+        for (auto& sg : sgs) {
+            sg->commit();
+        }
+        RegisterLog* log = registerLog.load(std::memory_order_acquire);
+        if (log != nullptr) {
+            logRegisters(log);
+        }
+        tick++;
+    }
+
+    void SynthEngine::logRegisters(RegisterLog* log) {
+        RegisterFrame* frame = log->beginPush();
+        if (frame == nullptr) {
+            return;
+        }
+        frame->tick = tick;
+        frame->chips = chips;
+        for (int chip = 0; chip < chips; chip++) {
+            for (int reg = 0; reg < AY_REGISTERS; reg++) {
+                frame->registers[chip][reg] = sgs[chip]->getRegister(reg);
+            }
+            frame->written[chip] = sgs[chip]->getCommittedRegisters();
+            for (int i = 0; i < 3; i++) {
+                frame->timerEffects[chip][i] = sgs[chip]->getTimerEffect(i);
+                frame->timerRates[chip][i] = sgs[chip]->getTimerRate(i);
+            }
         }
-        vp->update(updateRate);
+        log->endPush();
     }
 }
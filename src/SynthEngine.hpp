@@ -1,9 +1,17 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <vector>
 #include "SoundGenerator.hpp"
 #include "VoiceProcessor.hpp"
 #include "Channel.hpp"
+#include "NotePool.hpp"
+#include "WorkerPool.hpp"
+#include "RegisterLog.hpp"
+#include "DrumKit.hpp"
+#include "CommandQueue.hpp"
 
 namespace AyMidi {
 
@@ -77,7 +85,7 @@ namespace AyMidi {
         MIDI_CTL_SC7_VIBRATO_RATE     = 0x4C, /* Sound Controller 7 (default: Vibrato Rate) */
         MIDI_CTL_SC8_VIBRATO_DEPTH    = 0x4D, /* Sound Controller 8 (default: Vibrato Depth) */
         MIDI_CTL_SC9_VIBRATO_DELAY    = 0x4E, /* Sound Controller 9 (default: Vibrato Delay) */
-        MIDI_CTL_SC10                 = 0x4F, /* Sound Controller 10 (default: undefined)  */
+        MIDI_CTL_SC10_VIBRATO_WAVE    = 0x4F, /* Sound Controller 10 (AY/YM Vibrato Waveform) */
         MIDI_CTL_GENERAL_PURPOSE5     = 0x50, /* General Purpose Controller 5 */
         MIDI_CTL_GENERAL_PURPOSE6     = 0x51, /* General Purpose Controller 6 */
         MIDI_CTL_GENERAL_PURPOSE7     = 0x52, /* General Purpose Controller 7 */
@@ -105,6 +113,8 @@ namespace AyMidi {
         MIDI_CTL_AY_SUSTAIN           = 0x6D, /* AY/YM Noise Period */
         MIDI_CTL_AY_RELEASE           = 0x6E, /* AY/YM Noise Period */
         MIDI_CTL_AY_ARPEGGIO_RATE     = 0x6F, /* AY/YM Noise Period */
+        MIDI_CTL_AY_TIMER_EFFECT      = 0x70, /* AY/YM Timer Effect */
+        MIDI_CTL_AY_TIMER_DETUNE      = 0x71, /* AY/YM Timer Detune */
         MIDI_CTL_ALL_SOUNDS_OFF       = 0x78, /* All Sounds Off */
         MIDI_CTL_RESET_CONTROLLERS    = 0x79, /* Reset All Controllers */
         MIDI_CTL_LOCAL_CONTROL_SWITCH = 0x7A, /* Local Control On/Off */
@@ -115,29 +125,157 @@ namespace AyMidi {
         MIDI_CTL_POLY_MODE_ON         = 0x7F  /* Poly Mode On */
     } MidiControl;
 
+    // Engine settings that can be changed from outside the audio thread.
+    enum Setting {
+        SETTING_GAIN,
+        SETTING_CLOCK_RATE,
+        SETTING_EMUL,
+        SETTING_QUALITY,
+        SETTING_UPDATE_RATE,
+        SETTING_BASIC_CHANNEL,
+        SETTING_CHIPS,
+        SETTING_DRUM_CHANNEL
+    };
+
     class SynthEngine {
+        public:
+            constexpr static int maxChips = 8;
+            constexpr static int maxDrums = 3;
+            constexpr static int maxMidiEvents = 512;
+
+            // A message timed inside the next block, by sample offset.
+            struct MidiEvent {
+                uint32_t offset;
+                uint8_t message[3];
+            };
+
         private:
-            std::shared_ptr<SoundGenerator> sg;
-            std::shared_ptr<VoiceProcessor> vp;
-            std::shared_ptr<Channel> channels[16];
-            int updateRate;
-            int updatePeriod;
-            int updateCounter;
+            // Drum slots map to chip channels from the last one backwards.
+            struct DrumSlot {
+                int key = -1;
+                uint32_t age = 0;
+            };
+
+        public:
+            // The engine between two process calls, in one flat block that
+            // can be restored into any engine running at the same sample
+            // rate. Posted settings and the register log are left out.
+            struct State {
+                int sampleRate;
+                SoundGenerator::State chips[maxChips];
+                VoiceProcessor::State voices;
+                NotePool::State notes;
+                Channel::State channels[16];
+                uint16_t activeChannels;
+                uint32_t tick;
+                MidiEvent midiEvents[maxMidiEvents];
+                int midiEventCount;
+                DrumSlot drumSlots[maxDrums];
+                uint32_t drumAge;
+                uint32_t drumKitId;
+                int drumChannel;
+                int chipCount;
+                int updateRate;
+                int updatePeriod;
+                int updateCounter;
+                int baseChannel;
+                int lastChannel;
+                int monoChannels;
+            };
+
+        private:
+            // Chip count from which rendering is spread across worker threads.
+            constexpr static int parallelChips = 4;
+            // Blocks shorter than this are rendered on the calling thread.
+            constexpr static int parallelBlockSize = 32;
+            // Samples rendered at the end of a skip, enough to refill the
+            // longest decimator history. DC removal needs its filter length
+            // on top.
+            constexpr static uint32_t warmSamples = 64;
+
+            std::vector<std::unique_ptr<SoundGenerator>> sgs;
+            VoiceProcessor vp;
+            NotePool notePool;
+            std::unique_ptr<Channel> channels[16];
+            // Channels holding notes, the only ones updated on ticks.
+            uint16_t activeChannels = 0;
+            std::unique_ptr<WorkerPool> workerPool;
+            std::atomic<RegisterLog*> registerLog{nullptr};
+            uint32_t tick = 0;
+            // Messages for the next block, sorted by offset.
+            std::vector<MidiEvent> midiEvents;
+            // Settings posted from another thread, taken once per block and
+            // sorted by offset.
+            CommandQueue commands;
+            std::vector<Command> settings;
+            // Settings that found the queue full.
+            std::atomic<uint32_t> droppedSettings{0};
+            DrumSlot drumSlots[maxDrums];
+            uint32_t drumAge = 0;
+            std::atomic<const DrumKit*> drumKit{nullptr};
+            // Last kit set that the audio thread has seen.
+            std::atomic<const DrumKit*> pickedDrumKit{nullptr};
+            const DrumKit* currentDrumKit = nullptr;
+            int drumChannel = 9;
+            float chipLeft[maxChips][Decimator::maxBlockSize];
+            float chipRight[maxChips][Decimator::maxBlockSize];
+            int chips;
+            int updateRate = 0;
+            int updatePeriod = 0;
+            int updateCounter = 0;
             int baseChannel;
             int lastChannel;
+            int monoChannels;
             bool omniMode;
             bool polyMode;
 
+            static std::vector<std::unique_ptr<SoundGenerator>> makeChips(double sampleRate, int clockRate);
+            static const DrumKit* getDefaultDrumKit();
             MidiMsgStatus getMidiMsgStatus(const uint8_t* msg);
             void allNotesOff();
+            void updateLastChannel();
+            void applySetting(const Command& command);
+            void dispatch(const uint8_t* message, uint32_t offset);
+            void startNote(Note* note, uint32_t offset);
+            const DrumKit* getDrumKit();
+            void playDrum(int key, int velocity, uint32_t offset);
+            void stopDrums();
             void update();
+            void logRegisters(RegisterLog* log);
+            void run(float *left, float *right, const uint32_t size, const uint32_t warmFrom);
+            void render(float *left, float *right, const uint32_t size);
+            void skipChips(const uint32_t size, const uint32_t warmFrom);
 
         public:
-            SynthEngine(std::shared_ptr<SoundGenerator> sg);
+            SynthEngine(double sampleRate, int clockRate, bool parallel = true);
+            void setChips(int count);
+            int getChips() const;
+            void setGain(float gain);
+            void setClockRate(int clockRate);
+            void setEmul(Emul emul);
+            void setQuality(Quality quality);
+            void enableRemoveDc(bool enable = true);
             void setUpdateRate(int rate);
             void setBasicChannel(int nChannel);
+            uint64_t getRegisterWrites() const;
+            uint32_t getTicks() const;
+            int getActiveNotes() const;
+            uint64_t getVoiceSteals() const;
+            void setRegisterLog(RegisterLog* log);
+            void setDrumKit(const DrumKit* kit);
+            const DrumKit* getPickedDrumKit() const;
+            void setDrumChannel(int channel);
+            bool postSetting(Setting setting, float value, uint32_t offset = 0);
+            uint32_t getDroppedSettings() const;
+            void save(State& state) const;
+            bool restore(const State& state);
+            bool isIdle() const;
             void midiSend(const uint8_t* message);
+            void midiSend(const uint8_t* message, uint32_t offset);
+            void midiSend(const MidiEvent* events, uint32_t count);
             void process(float *left, float *right, const uint32_t size);
+            void skip(const uint32_t size, const bool warm = true);
+            void skip(const uint32_t size, const MidiEvent* events, uint32_t count);
     };
 
 }
@@ -3,11 +3,7 @@
 
 namespace AyMidi {
 
-    extern "C" {
-#include "ayumi.h"
-    }
-
-    Voice::Voice(std::shared_ptr<SoundGenerator> sg, int index) :
+    Voice::Voice(SoundGenerator& sg, int index) :
         sg(sg),
         index(index)
     {
@@ -19,52 +15,66 @@ namespace AyMidi {
         enableTone(false);
         enableNoise(false);
         setLevel(0);
+        stopTimer();
     }
 
     void Voice::setNoisePeriod(int period) {
-        sg->setNoisePeriod(period);
+        sg.setNoisePeriod(period);
     }
 
     void Voice::setEnvelopePeriod(int period) {
-        sg->setEnvelopePeriod(period);
+        sg.setEnvelopePeriod(period);
     }
 
-    void Voice::setEnvelopeFreq(int freq) {
-        sg->setEnvelopeFreq(freq);
+    void Voice::setEnvelopePitch(float pitch) {
+        sg.setEnvelopePeriod(sg.pitchToEnvelopePeriod(pitch));
     }
 
     void Voice::setEnvelopeShape(int shape) {
-        sg->setEnvelopeShape(shape);
+        sg.setEnvelopeShape(shape);
     }
 
     void Voice::enableTone(bool enable) {
-        toneOff = !enable;
-        ayumi_set_mixer(&*sg->getAyumi(), index, toneOff, noiseOff, envelopeOn);
+        sg.enableTone(index, enable);
     }
 
     void Voice::enableNoise(bool enable) {
-        noiseOff = !enable;
-        ayumi_set_mixer(&*sg->getAyumi(), index, toneOff, noiseOff, envelopeOn);
+        sg.enableNoise(index, enable);
     }
 
     void Voice::enableEnvelope(bool enable) {
-        envelopeOn = enable;
-        ayumi_set_mixer(&*sg->getAyumi(), index, toneOff, noiseOff, envelopeOn);
+        sg.enableEnvelope(index, enable);
     }
 
     void Voice::setLevel(int level) {
-        ayumi_set_volume(&*sg->getAyumi(), index, level);
+        sg.setLevel(index, level);
     }
 
     void Voice::setTonePeriod(int period) {
-        ayumi_set_tone(&*sg->getAyumi(), index, period);
+        sg.setTonePeriod(index, period);
     }
 
-    void Voice::setToneFreq(int freq) {
-        ayumi_set_tone(&*sg->getAyumi(), index, sg->freqToSquarePeriod(freq));
+    void Voice::setTonePitch(float pitch) {
+        sg.setTonePeriod(index, sg.pitchToTonePeriod(pitch));
     }
 
     void Voice::setPan(float pan) {
-        ayumi_set_pan(&*sg->getAyumi(), index, pan, 1);
+        sg.setPan(index, pan);
+    }
+
+    void Voice::setSyncSquare(float pitch) {
+        sg.setTimer(index, TIMER_SYNC_SQUARE, pitch);
+    }
+
+    void Voice::setSyncBuzzer(float pitch) {
+        sg.setTimer(index, TIMER_SYNC_BUZZER, pitch);
+    }
+
+    void Voice::setSid(float pitch) {
+        sg.setTimer(index, TIMER_SID, pitch);
+    }
+
+    void Voice::stopTimer() {
+        sg.setTimer(index, TIMER_OFF, 0.0f);
     }
 }
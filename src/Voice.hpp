@@ -1,6 +1,5 @@
 #pragma once
 
-#include <memory> 
 #include "SoundGenerator.hpp"
 
 namespace AyMidi {
@@ -8,31 +7,26 @@ namespace AyMidi {
     class Voice {
 
         private:
+            SoundGenerator& sg;
             int index;
-            bool toneOff = true;
-            bool noiseOff = true;
-            bool envelopeOn = false;
-            int tonePeriod;
-            int syncSquarePeriod;
-            double syncSquareCounter;
 
         public:
-            std::shared_ptr<SoundGenerator> sg;
-
-            Voice(std::shared_ptr<SoundGenerator> sg, int index);
+            Voice(SoundGenerator& sg, int index);
             void mute();
             void setNoisePeriod(int period);
             void setEnvelopePeriod(int period);
-            void setEnvelopeFreq(int freq);
+            void setEnvelopePitch(float pitch);
             void setEnvelopeShape(int shape);
             void enableTone(bool enable = true);
             void enableNoise(bool enable = true);
             void enableEnvelope(bool enable = true);
             void setLevel(int level);
             void setTonePeriod(int period);
-            void setToneFreq(int freq);
+            void setTonePitch(float pitch);
             void setPan(float pan);
-            void setSyncSquare(int period);
-            void setSyncBuzzer(int period);
+            void setSyncSquare(float pitch);
+            void setSyncBuzzer(float pitch);
+            void setSid(float pitch);
+            void stopTimer();
     };
 }
@@ -1,18 +1,35 @@
-#include "DistrhoUtils.hpp"
 #include "VoiceProcessor.hpp"
 
 namespace AyMidi {
 
-    VoiceProcessor::VoiceProcessor(std::shared_ptr<SoundGenerator> sg) {
-        this->sg = sg;
-        for (int i = 0; i < 3; i++) {
-            voices[i] = std::make_shared<Voice>(sg, i);
-            notes[i] = nullptr;
-            tokens[i] = 0;
+    VoiceProcessor::VoiceProcessor(const std::vector<std::unique_ptr<SoundGenerator>>& sgs) {
+        voices.reserve(sgs.size() * voicesPerChip);
+        for (auto& sg : sgs) {
+            for (int i = 0; i < voicesPerChip; i++) {
+                voices.emplace_back(*sg, i);
+                notes.push_back(nullptr);
+                tokens.push_back(0);
+            }
         }
+        voiceCount = voicesPerChip;
         lastToken = 0;
     }
 
+    void VoiceProcessor::setChips(int chips) {
+        voiceCount = std::min(chips * voicesPerChip, (int)voices.size());
+        for (int i = voiceCount; i < (int)voices.size(); i++) {
+            if (notes[i] != nullptr) {
+                notes[i]->setVoice(nullptr);
+                notes[i] = nullptr;
+            }
+            voices[i].mute();
+        }
+    }
+
+    int VoiceProcessor::getVoiceCount() const {
+        return voiceCount;
+    }
+
     void VoiceProcessor::setOmniMode(bool enable) {
         omniMode = enable;
     }
@@ -29,40 +46,57 @@ namespace AyMidi {
         return monoMode;
     }
 
+    // Notes cut off to make room for a new one.
+    uint64_t VoiceProcessor::getSteals() const {
+        return steals;
+    }
+
     int VoiceProcessor::findFreeVoice() {
         int oldestVoiceId = 0;
         int releasedVoiceId = -1;
 
-        for (int i = 0; i < 3; i++) {
-            auto note = notes[i];
+        for (int i = 0; i < voiceCount; i++) {
+            Note* note = notes[i];
             if (note == nullptr || !note->isValid()) {
                 return i;
             } else if (note->isReleased()) {
-                releasedVoiceId = i;
+                if (releasedVoiceId < 0 || tokens[i] < tokens[releasedVoiceId]) {
+                    releasedVoiceId = i;
+                }
             }
             if (tokens[i] < tokens[oldestVoiceId]) {
                 oldestVoiceId = i;
             }
         }
 
-        return std::max(releasedVoiceId, oldestVoiceId);
+        return releasedVoiceId >= 0 ? releasedVoiceId : oldestVoiceId;
     }
 
-    void VoiceProcessor::registerNote(std::shared_ptr<Note> note) {
+    void VoiceProcessor::registerNote(Note* note) {
         int voiceId;
         if (monoMode) {
             if (omniMode) {
                 voiceId = 0;
             } else {
-                voiceId = note->channelId % 3;
+                voiceId = note->channelId % voiceCount;
             }
         } else {
             voiceId = findFreeVoice();
+            if (notes[voiceId] != nullptr && notes[voiceId]->isValid()) {
+                steals++;
+            }
             if (notes[voiceId] != nullptr) {
                 notes[voiceId]->setVoice(nullptr);
             }
         }
-        note->setVoice(voices[voiceId]);
+        // A note moved to another voice, by mono mode or an arpeggio, leaves
+        // the one it had.
+        const int previousId = indexOf(note->getVoice());
+        if (previousId >= 0 && previousId != voiceId && notes[previousId] == note) {
+            voices[previousId].mute();
+            notes[previousId] = nullptr;
+        }
+        note->setVoice(&voices[voiceId]);
         if (notes[voiceId] != nullptr && notes[voiceId]->isValid() && notes[voiceId]->channelId == note->channelId) {
             note->setStartKey(notes[voiceId]->key);
         }
@@ -70,15 +104,57 @@ namespace AyMidi {
         tokens[voiceId] = lastToken++;
     }
 
+    void VoiceProcessor::unregisterNote(Note* note) {
+        for (int i = 0; i < voiceCount; i++) {
+            if (notes[i] == note) {
+                voices[i].mute();
+                notes[i] = nullptr;
+            }
+        }
+        note->setVoice(nullptr);
+    }
+
+    int VoiceProcessor::indexOf(const Voice* voice) const {
+        return voice == nullptr ? -1 : voice - voices.data();
+    }
+
+    Voice* VoiceProcessor::getVoice(int index) {
+        return index < 0 ? nullptr : &voices[index];
+    }
+
+    void VoiceProcessor::save(State& state, const NotePool& pool) const {
+        for (size_t i = 0; i < voices.size(); i++) {
+            state.notes[i] = pool.indexOf(notes[i]);
+            state.tokens[i] = tokens[i];
+        }
+        state.lastToken = lastToken;
+        state.voiceCount = voiceCount;
+        state.omniMode = omniMode;
+        state.monoMode = monoMode;
+        state.steals = steals;
+    }
+
+    void VoiceProcessor::restore(const State& state, NotePool& pool) {
+        for (size_t i = 0; i < voices.size(); i++) {
+            notes[i] = pool.getNote(state.notes[i]);
+            tokens[i] = state.tokens[i];
+        }
+        lastToken = state.lastToken;
+        voiceCount = state.voiceCount;
+        omniMode = state.omniMode;
+        monoMode = state.monoMode;
+        steals = state.steals;
+    }
+
     void VoiceProcessor::update(int updateRate) {
-        for (int i = 0; i < 3; i++) {
-            std::shared_ptr<Note> note = notes[i];
+        for (int i = 0; i < voiceCount; i++) {
+            Note*& note = notes[i];
             if (note != nullptr) {
                 if (note->isValid()) {
                     note->update(updateRate);
                 } else {
-                    voices[i]->mute();
-                    notes[i] = nullptr;
+                    voices[i].mute();
+                    note = nullptr;
                 }
             }
         }
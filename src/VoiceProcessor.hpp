@@ -2,32 +2,57 @@
 
 #include <cstdint>
 #include <memory>
+#include <vector>
 #include "SoundGenerator.hpp"
 #include "Note.hpp"
 #include "Voice.hpp"
+#include "NotePool.hpp"
 
 namespace AyMidi {
 
     class VoiceProcessor {
 
         private:
-            std::shared_ptr<SoundGenerator> sg;
-            std::shared_ptr<Voice> voices[3];
-            std::shared_ptr<Note> notes[3];
-            std::uint32_t tokens[3]; 
+            std::vector<Voice> voices;
+            std::vector<Note*> notes;
+            std::vector<std::uint32_t> tokens;
             std::uint32_t lastToken;
+            int voiceCount;
+            uint64_t steals = 0;
             bool omniMode;
             bool monoMode;
 
             int findFreeVoice();
 
         public:
-            VoiceProcessor(std::shared_ptr<SoundGenerator> sg);
+            constexpr static int voicesPerChip = 3;
+            constexpr static int maxVoices = 8 * voicesPerChip;
+
+            // Notes are stored as pool indices.
+            struct State {
+                int notes[maxVoices];
+                std::uint32_t tokens[maxVoices];
+                std::uint32_t lastToken;
+                int voiceCount;
+                bool omniMode;
+                bool monoMode;
+                uint64_t steals;
+            };
+
+            VoiceProcessor(const std::vector<std::unique_ptr<SoundGenerator>>& sgs);
+            void setChips(int chips);
+            int getVoiceCount() const;
             void setOmniMode(bool enable);
             bool getOmniMode() const;
             void setMonoMode(bool enable);
             bool getMonoMode() const;
-            void registerNote(std::shared_ptr<Note> note);
+            uint64_t getSteals() const;
+            void registerNote(Note* note);
+            void unregisterNote(Note* note);
             void update(int updateRate);
+            int indexOf(const Voice* voice) const;
+            Voice* getVoice(int index);
+            void save(State& state, const NotePool& pool) const;
+            void restore(const State& state, NotePool& pool);
     };
 }
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include "WorkerPool.hpp"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+namespace AyMidi {
+
+    WorkerPool::WorkerPool(int threadCount) {
+#ifdef __linux__
+        sem_init(&wake, 0, 0);
+#endif
+        for (int i = 0; i < threadCount; i++) {
+            threads.emplace_back(&WorkerPool::workerLoop, this);
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        stopping.store(true, std::memory_order_release);
+        post(threads.size());
+        for (auto& thread : threads) {
+            thread.join();
+        }
+#ifdef __linux__
+        sem_destroy(&wake);
+#endif
+    }
+
+    int WorkerPool::getThreadCount() const {
+        return threads.size();
+    }
+
+    // Wakes up to count workers, workers already awake take the extra
+    // wakeups and find nothing to do.
+    void WorkerPool::post(int count) {
+#ifdef __linux__
+        for (int i = 0; i < count; i++) {
+            sem_post(&wake);
+        }
+#else
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            wakeups += count;
+        }
+        wake.notify_all();
+#endif
+    }
+
+    void WorkerPool::waitWake() {
+#ifdef __linux__
+        while (sem_wait(&wake) != 0) {
+        }
+#else
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return wakeups > 0; });
+        wakeups--;
+#endif
+    }
+
+    // Called by the workers, once per change of the dispatching thread.
+    void WorkerPool::followScheduling() {
+#ifndef _WIN32
+        sched_param param;
+        param.sched_priority = schedulingPriority.load(std::memory_order_relaxed);
+        pthread_setschedparam(pthread_self(), schedulingPolicy.load(std::memory_order_relaxed), &param);
+#endif
+    }
+
+    // Takes the next job of the batch, -1 when they are all taken or the
+    // batch is over.
+    int WorkerPool::claim(uint32_t batch) {
+        uint64_t current = claims.load(std::memory_order_acquire);
+        while ((uint32_t)(current >> 32) == batch && (uint32_t)current < (uint32_t)jobCount.load(std::memory_order_acquire)) {
+            if (claims.compare_exchange_weak(current, current + 1, std::memory_order_acq_rel)) {
+                return (uint32_t)current;
+            }
+        }
+        return -1;
+    }
+
+    // The job read may belong to a newer batch than the one loaded, but then
+    // the loaded batch is closed and no claim on it succeeds.
+    void WorkerPool::workerLoop() {
+        unsigned schedulingSeen = 0;
+        while (true) {
+            waitWake();
+            if (stopping.load(std::memory_order_acquire)) {
+                return;
+            }
+            const unsigned changes = schedulingChanges.load(std::memory_order_acquire);
+            if (changes != schedulingSeen) {
+                schedulingSeen = changes;
+                followScheduling();
+            }
+            const uint32_t batch = claims.load(std::memory_order_acquire) >> 32;
+            const Job currentJob = job.load(std::memory_order_acquire);
+            void* const currentContext = context.load(std::memory_order_acquire);
+            int index;
+            while ((index = claim(batch)) >= 0) {
+                currentJob(currentContext, index);
+                finishedJobs.fetch_add(1, std::memory_order_release);
+            }
+        }
+    }
+
+    // A new batch only starts once every job of the previous one finished.
+    // It is closed while its fields change, so that a worker reading them
+    // can't claim a job with them on the previous batch.
+    void WorkerPool::dispatch(int count, Job job, void* context) {
+        if (threads.empty() || count < 2) {
+            for (int i = 0; i < count; i++) {
+                job(context, i);
+            }
+            return;
+        }
+#ifndef _WIN32
+        if (!dispatched || dispatcher != std::this_thread::get_id()) {
+            int policy;
+            sched_param param;
+            if (pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+                schedulingPolicy.store(policy, std::memory_order_relaxed);
+                schedulingPriority.store(param.sched_priority, std::memory_order_relaxed);
+                schedulingChanges.fetch_add(1, std::memory_order_release);
+            }
+        }
+#endif
+        dispatched = true;
+        dispatcher = std::this_thread::get_id();
+        const uint32_t batch = (uint32_t)(claims.load(std::memory_order_relaxed) >> 32) + 1;
+        claims.store((uint64_t)batch << 32 | closed, std::memory_order_relaxed);
+        this->job.store(job, std::memory_order_release);
+        this->context.store(context, std::memory_order_release);
+        jobCount.store(count, std::memory_order_release);
+        finishedJobs.store(0, std::memory_order_relaxed);
+        claims.store((uint64_t)batch << 32, std::memory_order_release);
+        post(std::min<int>(threads.size(), count - 1));
+        int index;
+        while ((index = claim(batch)) >= 0) {
+            job(context, index);
+            finishedJobs.fetch_add(1, std::memory_order_release);
+        }
+        // Only jobs already running on a worker are left.
+        while (finishedJobs.load(std::memory_order_acquire) < count) {
+            std::this_thread::yield();
+        }
+    }
+}
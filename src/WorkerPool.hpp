@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <semaphore.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace AyMidi {
+
+    // Threads sharing batches of jobs with the thread that hands them out,
+    // which may be the audio thread. It doesn't take a lock on Linux: workers
+    // are woken through a semaphore, elsewhere they are notified after a
+    // short lock. Jobs are claimed with atomics, and jobs no worker claimed
+    // in time are run by the dispatching thread itself. Workers take up the
+    // scheduling policy and priority of that thread where the system allows
+    // it.
+    class WorkerPool {
+
+        private:
+            typedef void (*Job)(void* context, int index);
+
+            // Job index of a batch that can't be claimed from yet.
+            constexpr static uint32_t closed = 0xFFFFFFFF;
+
+            std::vector<std::thread> threads;
+            // Batch number in the upper 32 bits, next job index in the lower
+            // ones.
+            std::atomic<uint64_t> claims{0};
+            std::atomic<Job> job{nullptr};
+            std::atomic<void*> context{nullptr};
+            std::atomic<int> jobCount{0};
+            std::atomic<int> finishedJobs{0};
+            std::atomic<bool> stopping{false};
+            std::atomic<unsigned> schedulingChanges{0};
+            std::atomic<int> schedulingPolicy{0};
+            std::atomic<int> schedulingPriority{0};
+            bool dispatched = false;
+            std::thread::id dispatcher;
+#ifdef __linux__
+            sem_t wake;
+#else
+            std::mutex mutex;
+            std::condition_variable wake;
+            int wakeups = 0;
+#endif
+
+            void post(int count);
+            void waitWake();
+            void followScheduling();
+            int claim(uint32_t batch);
+            void workerLoop();
+            void dispatch(int count, Job job, void* context);
+
+        public:
+            WorkerPool(int threadCount);
+            ~WorkerPool();
+            int getThreadCount() const;
+
+            // Runs f(0) ... f(count - 1) on the pool and the calling thread,
+            // returns when all of them have finished.
+            template <typename F>
+            void run(int count, F& f) {
+                dispatch(count, [](void* context, int index) { (*static_cast<F*>(context))(index); }, &f);
+            }
+    };
+}
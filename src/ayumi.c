@@ -126,7 +126,14 @@ int update_envelope(struct ayumi* ay) {
   return ay->envelope;
 }
 
-static void update_mixer(struct ayumi* ay) {
+#if defined(__GNUC__)
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE static inline
+#endif
+
+/* Centered, the sum of the left side is taken for both. */
+ALWAYS_INLINE void mix(struct ayumi* ay, const double* dac_table, int centered) {
   int i;
   int out;
   int noise = update_noise(ay);
@@ -136,23 +143,31 @@ static void update_mixer(struct ayumi* ay) {
   for (i = 0; i < TONE_CHANNELS; i += 1) {
     out = (update_tone(ay, i) | ay->channels[i].t_off) & (noise | ay->channels[i].n_off);
     out *= ay->channels[i].e_on ? envelope : ay->channels[i].volume * 2 + 1;
-    ay->left += ay->dac_table[out] * ay->channels[i].pan_left;
-    ay->right += ay->dac_table[out] * ay->channels[i].pan_right;
+    ay->left += dac_table[out] * ay->channels[i].pan_left;
+    if (!centered) {
+      ay->right += dac_table[out] * ay->channels[i].pan_right;
+    }
   }
+  if (centered) {
+    ay->right = ay->left;
+  }
+}
+
+static void update_mixer(struct ayumi* ay) {
+  mix(ay, ay->dac_table, 0);
 }
 
 int ayumi_configure(struct ayumi* ay, int is_ym, double clock_rate, int sr) {
   int i;
   memset(ay, 0, sizeof(struct ayumi));
-  ay->step = clock_rate / (sr * 8 * DECIMATE_FACTOR);
+  ay->step = llround(clock_rate / (sr * 8 * DECIMATE_FACTOR) * PHASE_ONE);
   ay->dac_table = is_ym ? YM_dac_table : AY_dac_table;
   ay->noise = 1;
   ayumi_set_envelope(ay, 1);
   for (i = 0; i < TONE_CHANNELS; i += 1) {
     ayumi_set_tone(ay, i, 1);
   }
-  ay->decimate_factor = DECIMATE_FACTOR;
-  return ay->step < 1;
+  return ay->step < PHASE_ONE;
 }
 
 void ayumi_set_pan(struct ayumi* ay, int index, double pan, int is_eqp) {
@@ -195,145 +210,263 @@ void ayumi_set_envelope_shape(struct ayumi* ay, int shape) {
   reset_segment(ay);
 }
 
-static double decimate(double* x) {
-  double y = -0.0000046183113992051936 * (x[1] + x[191]) +
-    -0.00001117761640887225 * (x[2] + x[190]) +
-    -0.000018610264502005432 * (x[3] + x[189]) +
-    -0.000025134586135631012 * (x[4] + x[188]) +
-    -0.000028494281690666197 * (x[5] + x[187]) +
-    -0.000026396828793275159 * (x[6] + x[186]) +
-    -0.000017094212558802156 * (x[7] + x[185]) +
-    0.000023798193576966866 * (x[9] + x[183]) +
-    0.000051281160242202183 * (x[10] + x[182]) +
-    0.00007762197826243427 * (x[11] + x[181]) +
-    0.000096759426664120416 * (x[12] + x[180]) +
-    0.00010240229300393402 * (x[13] + x[179]) +
-    0.000089344614218077106 * (x[14] + x[178]) +
-    0.000054875700118949183 * (x[15] + x[177]) +
-    -0.000069839082210680165 * (x[17] + x[175]) +
-    -0.0001447966132360757 * (x[18] + x[174]) +
-    -0.00021158452917708308 * (x[19] + x[173]) +
-    -0.00025535069106550544 * (x[20] + x[172]) +
-    -0.00026228714374322104 * (x[21] + x[171]) +
-    -0.00022258805927027799 * (x[22] + x[170]) +
-    -0.00013323230495695704 * (x[23] + x[169]) +
-    0.00016182578767055206 * (x[25] + x[167]) +
-    0.00032846175385096581 * (x[26] + x[166]) +
-    0.00047045611576184863 * (x[27] + x[165]) +
-    0.00055713851457530944 * (x[28] + x[164]) +
-    0.00056212565121518726 * (x[29] + x[163]) +
-    0.00046901918553962478 * (x[30] + x[162]) +
-    0.00027624866838952986 * (x[31] + x[161]) +
-    -0.00032564179486838622 * (x[33] + x[159]) +
-    -0.00065182310286710388 * (x[34] + x[158]) +
-    -0.00092127787309319298 * (x[35] + x[157]) +
-    -0.0010772534348943575 * (x[36] + x[156]) +
-    -0.0010737727700273478 * (x[37] + x[155]) +
-    -0.00088556645390392634 * (x[38] + x[154]) +
-    -0.00051581896090765534 * (x[39] + x[153]) +
-    0.00059548767193795277 * (x[41] + x[151]) +
-    0.0011803558710661009 * (x[42] + x[150]) +
-    0.0016527320270369871 * (x[43] + x[149]) +
-    0.0019152679330965555 * (x[44] + x[148]) +
-    0.0018927324805381538 * (x[45] + x[147]) +
-    0.0015481870327877937 * (x[46] + x[146]) +
-    0.00089470695834941306 * (x[47] + x[145]) +
-    -0.0010178225878206125 * (x[49] + x[143]) +
-    -0.0020037400552054292 * (x[50] + x[142]) +
-    -0.0027874356824117317 * (x[51] + x[141]) +
-    -0.003210329988021943 * (x[52] + x[140]) +
-    -0.0031540624117984395 * (x[53] + x[139]) +
-    -0.0025657163651900345 * (x[54] + x[138]) +
-    -0.0014750752642111449 * (x[55] + x[137]) +
-    0.0016624165446378462 * (x[57] + x[135]) +
-    0.0032591192839069179 * (x[58] + x[134]) +
-    0.0045165685815867747 * (x[59] + x[133]) +
-    0.0051838984346123896 * (x[60] + x[132]) +
-    0.0050774264697459933 * (x[61] + x[131]) +
-    0.0041192521414141585 * (x[62] + x[130]) +
-    0.0023628575417966491 * (x[63] + x[129]) +
-    -0.0026543507866759182 * (x[65] + x[127]) +
-    -0.0051990251084333425 * (x[66] + x[126]) +
-    -0.0072020238234656924 * (x[67] + x[125]) +
-    -0.0082672928192007358 * (x[68] + x[124]) +
-    -0.0081033739572956287 * (x[69] + x[123]) +
-    -0.006583111539570221 * (x[70] + x[122]) +
-    -0.0037839040415292386 * (x[71] + x[121]) +
-    0.0042781252851152507 * (x[73] + x[119]) +
-    0.0084176358598320178 * (x[74] + x[118]) +
-    0.01172566057463055 * (x[75] + x[117]) +
-    0.013550476647788672 * (x[76] + x[116]) +
-    0.013388189369997496 * (x[77] + x[115]) +
-    0.010979501242341259 * (x[78] + x[114]) +
-    0.006381274941685413 * (x[79] + x[113]) +
-    -0.007421229604153888 * (x[81] + x[111]) +
-    -0.01486456304340213 * (x[82] + x[110]) +
-    -0.021143584622178104 * (x[83] + x[109]) +
-    -0.02504275058758609 * (x[84] + x[108]) +
-    -0.025473530942547201 * (x[85] + x[107]) +
-    -0.021627310017882196 * (x[86] + x[106]) +
-    -0.013104323383225543 * (x[87] + x[105]) +
-    0.017065133989980476 * (x[89] + x[103]) +
-    0.036978919264451952 * (x[90] + x[102]) +
-    0.05823318062093958 * (x[91] + x[101]) +
-    0.079072012081405949 * (x[92] + x[100]) +
-    0.097675998716952317 * (x[93] + x[99]) +
-    0.11236045936950932 * (x[94] + x[98]) +
-    0.12176343577287731 * (x[95] + x[97]) +
-    0.125 * x[96];
-  memcpy(&x[FIR_SIZE - DECIMATE_FACTOR], x, DECIMATE_FACTOR * sizeof(double));
-  return y;
-}
-
-// single_cycle: when set to true, run a single PSG cycle so that the internal
-// counters are incremented. Needed for square tone sync.
-int ayumi_process(struct ayumi* ay, int single_cycle) {
+/* Steps until a counter stepped like update_tone does wraps, that step
+   included. */
+static int64_t next_wrap(int counter, int period) {
+  if (period < 1) {
+    period = 1;
+  }
+  return counter < period ? period - counter : 1;
+}
+
+/* Steps a counter like update_tone does, count times, and returns how many
+   times it wrapped. */
+static int64_t skip_counter(int* counter, int period, int64_t count) {
+  int64_t first = next_wrap(*counter, period);
+  if (period < 1) {
+    period = 1;
+  }
+  if (count < first) {
+    *counter += (int) count;
+    return 0;
+  }
+  *counter = (int) ((count - first) % period);
+  return 1 + (count - first) / period;
+}
+
+/* Taps at bits 0 and 3, so up to 14 steps can be taken at once. */
+static void skip_noise(struct ayumi* ay, int64_t count) {
+  int noise = ay->noise;
+  for (; count >= 14; count -= 14) {
+    noise = (noise >> 14) | (((noise ^ (noise >> 3)) & 0x3fff) << 3);
+  }
+  if (count > 0) {
+    noise = (noise >> count) | (((noise ^ (noise >> 3)) & ((1 << count) - 1)) << (17 - count));
+  }
+  ay->noise = noise;
+}
+
+/* Shapes that never hold repeat every two segments of 32 steps. */
+static void skip_envelope(struct ayumi* ay, int64_t count) {
+  void (* const* shape)(struct ayumi*) = Envelopes[ay->envelope_shape];
+  if (shape[0] != hold_top && shape[0] != hold_bottom && shape[1] != hold_top && shape[1] != hold_bottom) {
+    count %= 64;
+  }
+  for (; count > 0; count -= 1) {
+    if (shape[ay->envelope_segment] == hold_top || shape[ay->envelope_segment] == hold_bottom) {
+      return;
+    }
+    shape[ay->envelope_segment](ay);
+  }
+}
+
+static void skip_generators(struct ayumi* ay, int64_t count) {
+  int i;
+  skip_noise(ay, skip_counter(&ay->noise_counter, ay->noise_period << 1, count));
+  skip_envelope(ay, skip_counter(&ay->envelope_counter, ay->envelope_period, count));
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    ay->channels[i].tone ^= skip_counter(&ay->channels[i].tone_counter, ay->channels[i].tone_period, count) & 1;
+  }
+}
+
+/* Keeps the phase of a run of steps within 64 bits. */
+#define QUIET_LIMIT ((int64_t) 1 << 30)
+
+/* Chip steps to come that mix the same output as the last one, up to
+   limit: those before any generator heard in the mix changes. */
+static int64_t quiet_steps(struct ayumi* ay, int64_t limit) {
+  void (* const* shape)(struct ayumi*) = Envelopes[ay->envelope_shape];
+  int64_t steps = limit;
+  int noise = 0;
+  int envelope = 0;
+  int i;
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    if (!ay->channels[i].t_off && next_wrap(ay->channels[i].tone_counter, ay->channels[i].tone_period) - 1 < steps) {
+      steps = next_wrap(ay->channels[i].tone_counter, ay->channels[i].tone_period) - 1;
+    }
+    noise |= !ay->channels[i].n_off;
+    envelope |= ay->channels[i].e_on;
+  }
+  if (noise && next_wrap(ay->noise_counter, ay->noise_period << 1) - 1 < steps) {
+    steps = next_wrap(ay->noise_counter, ay->noise_period << 1) - 1;
+  }
+  if (envelope && shape[ay->envelope_segment] != hold_top && shape[ay->envelope_segment] != hold_bottom
+    && next_wrap(ay->envelope_counter, ay->envelope_period) - 1 < steps) {
+    steps = next_wrap(ay->envelope_counter, ay->envelope_period) - 1;
+  }
+  return steps;
+}
+
+/* Once the last four chip steps mixed the same output, the interpolator is
+   flat and holds it until the next change a generator makes. The samples
+   up to there, at most count, take its value and the generators are only
+   counted forward. Returns the number of samples written. */
+static int hold_output(struct ayumi* ay, double* left, double* right, int count, int centered) {
+  const double* c_left = ay->interpolator_left.c;
+  const double* c_right = ay->interpolator_right.c;
+  const uint64_t end = (uint64_t) (quiet_steps(ay, QUIET_LIMIT) + 1) << PHASE_BITS;
+  int64_t n = (end - 1 - ay->x) / ay->step;
+  double x;
+  double value_left;
+  double value_right;
+  int i;
+  if (n > count) {
+    n = count;
+  }
+  if (n <= 0) {
+    return 0;
+  }
+  /* Worked out as the interpolation would, down to the sign of zero. */
+  x = (ay->x + ay->step) * (1.0 / PHASE_ONE);
+  value_left = (c_left[2] * x + c_left[1]) * x + c_left[0];
+  value_right = centered ? value_left : (c_right[2] * x + c_right[1]) * x + c_right[0];
+  ay->x += ay->step * n;
+  skip_generators(ay, ay->x >> PHASE_BITS);
+  ay->x &= PHASE_ONE - 1;
+  for (i = 0; i < n; i += 1) {
+    left[i] = value_left;
+    right[i] = value_right;
+  }
+  return (int) n;
+}
+
+/* The loop of ayumi_oversample, built for each DAC table and for both sides
+   apart or centered. Centered, the right interpolator is left behind and
+   takes the left one at the end. */
+ALWAYS_INLINE void oversample(struct ayumi* ay, double* left, double* right, int count,
+  const double* dac_table, int centered) {
   int i;
-  int exit = 0;
+  int updated;
   double y1;
+  double x;
   double* c_left = ay->interpolator_left.c;
   double* y_left = ay->interpolator_left.y;
   double* c_right = ay->interpolator_right.c;
   double* y_right = ay->interpolator_right.y;
-  double* fir_left = &ay->fir_left[FIR_SIZE - ay->fir_index * DECIMATE_FACTOR];
-  double* fir_right = &ay->fir_right[FIR_SIZE - ay->fir_index * DECIMATE_FACTOR];
-  for (i = ay->decimate_factor - 1; i >= 0; i -= 1) {
+  for (i = 0; i < count; i += 1) {
     ay->x += ay->step;
-    if (ay->x >= 1) {
-      ay->x -= 1;
+    updated = 0;
+    /* Low oversampling factors can take several chip steps per sample. */
+    while (ay->x >= PHASE_ONE) {
+      ay->x -= PHASE_ONE;
       y_left[0] = y_left[1];
       y_left[1] = y_left[2];
       y_left[2] = y_left[3];
-      y_right[0] = y_right[1];
-      y_right[1] = y_right[2];
-      y_right[2] = y_right[3];
-      update_mixer(ay);
+      if (!centered) {
+        y_right[0] = y_right[1];
+        y_right[1] = y_right[2];
+        y_right[2] = y_right[3];
+      }
+      mix(ay, dac_table, centered);
       y_left[3] = ay->left;
-      y_right[3] = ay->right;
+      if (!centered) {
+        y_right[3] = ay->right;
+      }
+      updated = 1;
+    }
+    if (updated) {
       y1 = y_left[2] - y_left[0];
       c_left[0] = 0.5 * y_left[1] + 0.25 * (y_left[0] + y_left[2]);
       c_left[1] = 0.5 * y1;
       c_left[2] = 0.25 * (y_left[3] - y_left[1] - y1);
-      y1 = y_right[2] - y_right[0];
-      c_right[0] = 0.5 * y_right[1] + 0.25 * (y_right[0] + y_right[2]);
-      c_right[1] = 0.5 * y1;
-      c_right[2] = 0.25 * (y_right[3] - y_right[1] - y1);
-      if (single_cycle) {
-        exit = 1;
+      if (!centered) {
+        y1 = y_right[2] - y_right[0];
+        c_right[0] = 0.5 * y_right[1] + 0.25 * (y_right[0] + y_right[2]);
+        c_right[1] = 0.5 * y1;
+        c_right[2] = 0.25 * (y_right[3] - y_right[1] - y1);
       }
     }
-    fir_left[i] = (c_left[2] * ay->x + c_left[1]) * ay->x + c_left[0];
-    fir_right[i] = (c_right[2] * ay->x + c_right[1]) * ay->x + c_right[0];
-    if (exit) {
-      ay->decimate_factor = i;
+    x = ay->x * (1.0 / PHASE_ONE);
+    left[i] = (c_left[2] * x + c_left[1]) * x + c_left[0];
+    right[i] = centered ? left[i] : (c_right[2] * x + c_right[1]) * x + c_right[0];
+    if (updated && y_left[0] == y_left[3] && y_left[1] == y_left[3] && y_left[2] == y_left[3]
+      && (centered || (y_right[0] == y_right[3] && y_right[1] == y_right[3] && y_right[2] == y_right[3]))) {
+      i += hold_output(ay, left + i + 1, right + i + 1, count - i - 1, centered);
+    }
+  }
+  if (centered) {
+    ay->interpolator_right = ay->interpolator_left;
+  }
+}
+
+static void oversample_ay(struct ayumi* ay, double* left, double* right, int count) {
+  oversample(ay, left, right, count, AY_dac_table, 0);
+}
+
+static void oversample_ay_centered(struct ayumi* ay, double* left, double* right, int count) {
+  oversample(ay, left, right, count, AY_dac_table, 1);
+}
+
+static void oversample_ym(struct ayumi* ay, double* left, double* right, int count) {
+  oversample(ay, left, right, count, YM_dac_table, 0);
+}
+
+static void oversample_ym_centered(struct ayumi* ay, double* left, double* right, int count) {
+  oversample(ay, left, right, count, YM_dac_table, 1);
+}
+
+static void (* const Oversamplers[][2])(struct ayumi*, double*, double*, int) = {
+  {oversample_ay, oversample_ay_centered},
+  {oversample_ym, oversample_ym_centered}
+};
+
+/* Both sides carry the same output: every channel is panned to the middle
+   and the interpolators agree. */
+int ayumi_is_centered(const struct ayumi* ay) {
+  int i;
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    if (ay->channels[i].pan_left != ay->channels[i].pan_right) {
       return 0;
     }
   }
-  ay->left = decimate(fir_left);
-  ay->right = decimate(fir_right);
-  ay->fir_index = (ay->fir_index + 1) % (FIR_SIZE / DECIMATE_FACTOR - 1);
-  ay->decimate_factor = DECIMATE_FACTOR;
-  return 1;
+  return memcmp(&ay->interpolator_left, &ay->interpolator_right, sizeof(struct interpolator)) == 0;
+}
+
+// Run count oversampled steps and store the interpolated output in left and
+// right in time order. The caller is in charge of the decimation.
+void ayumi_oversample(struct ayumi* ay, double* left, double* right, int count) {
+  Oversamplers[ay->dac_table == YM_dac_table][ayumi_is_centered(ay)](ay, left, right, count);
+}
+
+/* Advance count oversampled steps like ayumi_oversample without output. The
+   generators jump straight to their last steps, which are run in full as
+   they feed the interpolator. */
+void ayumi_skip(struct ayumi* ay, int count) {
+  int i;
+  double y1;
+  double* c_left = ay->interpolator_left.c;
+  double* y_left = ay->interpolator_left.y;
+  double* c_right = ay->interpolator_right.c;
+  double* y_right = ay->interpolator_right.y;
+  int64_t steps;
+  ay->x += ay->step * count;
+  steps = ay->x >> PHASE_BITS;
+  ay->x &= PHASE_ONE - 1;
+  if (steps > 4) {
+    skip_generators(ay, steps - 4);
+    steps = 4;
+  }
+  for (i = 0; i < steps; i += 1) {
+    y_left[0] = y_left[1];
+    y_left[1] = y_left[2];
+    y_left[2] = y_left[3];
+    y_right[0] = y_right[1];
+    y_right[1] = y_right[2];
+    y_right[2] = y_right[3];
+    update_mixer(ay);
+    y_left[3] = ay->left;
+    y_right[3] = ay->right;
+  }
+  if (steps > 0) {
+    y1 = y_left[2] - y_left[0];
+    c_left[0] = 0.5 * y_left[1] + 0.25 * (y_left[0] + y_left[2]);
+    c_left[1] = 0.5 * y1;
+    c_left[2] = 0.25 * (y_left[3] - y_left[1] - y1);
+    y1 = y_right[2] - y_right[0];
+    c_right[0] = 0.5 * y_right[1] + 0.25 * (y_right[0] + y_right[2]);
+    c_right[1] = 0.5 * y1;
+    c_right[2] = 0.25 * (y_right[3] - y_right[1] - y1);
+  }
 }
 
 static double dc_filter(struct dc_filter* dc, int index, double x) {
@@ -3,6 +3,8 @@
 #ifndef AYUMI_H
 #define AYUMI_H
 
+#include <stdint.h>
+
 enum {
   TONE_CHANNELS = 3,
   DECIMATE_FACTOR = 8,
@@ -10,6 +12,11 @@ enum {
   DC_FILTER_SIZE = 1024
 };
 
+/* The oversampling phase is fixed point, so that any number of steps can be
+   skipped exactly. */
+#define PHASE_BITS 32
+#define PHASE_ONE ((uint64_t) 1 << PHASE_BITS)
+
 struct tone_channel {
   int tone_period;
   int tone_counter;
@@ -43,19 +50,15 @@ struct ayumi {
   int envelope_segment;
   int envelope;
   const double* dac_table;
-  double step;
-  double x;
+  uint64_t step;
+  uint64_t x;
   struct interpolator interpolator_left;
   struct interpolator interpolator_right;
-  double fir_left[FIR_SIZE * 2];
-  double fir_right[FIR_SIZE * 2];
-  int fir_index;
   struct dc_filter dc_left;
   struct dc_filter dc_right;
   int dc_index;
   double left;
   double right;
-  int decimate_factor;
 };
 
 int ayumi_configure(struct ayumi* ay, int is_ym, double clock_rate, int sr);
@@ -66,7 +69,9 @@ void ayumi_set_mixer(struct ayumi* ay, int index, int t_off, int n_off, int e_on
 void ayumi_set_volume(struct ayumi* ay, int index, int volume);
 void ayumi_set_envelope(struct ayumi* ay, int period);
 void ayumi_set_envelope_shape(struct ayumi* ay, int shape);
-int ayumi_process(struct ayumi* ay, int single_cycle);
+void ayumi_oversample(struct ayumi* ay, double* left, double* right, int count);
+int ayumi_is_centered(const struct ayumi* ay);
+void ayumi_skip(struct ayumi* ay, int count);
 void ayumi_remove_dc(struct ayumi* ay);
 
 #endif
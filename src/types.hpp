@@ -28,8 +28,12 @@ namespace AyMidi {
             float vibratoRate; // In Hz
             float vibratoDepth; // In semitones
             int vibratoDelay; // In tenths of a second
+            int vibratoWaveform;
+            float vibrato; // LFO output for the current tick, from -1 to 1
             bool portamento;
             int portamentoTime;
             int portamentoControl;
+            int timerEffect;
+            float timerDetune;
     };
 }
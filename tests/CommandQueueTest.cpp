@@ -0,0 +1,103 @@
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "CommandQueue.hpp"
+
+using namespace AyMidi;
+
+int main() {
+    CommandQueue queue(5);
+    if (queue.getCapacity() != 8) {
+        std::fprintf(stderr, "capacity %d instead of 8\n", queue.getCapacity());
+        return 1;
+    }
+    for (int i = 0; i < 8; i++) {
+        if (!queue.push({0, i, 0.0f})) {
+            std::fprintf(stderr, "push %d refused\n", i);
+            return 1;
+        }
+    }
+    if (queue.push({0, 8, 0.0f})) {
+        std::fprintf(stderr, "push accepted while full\n");
+        return 1;
+    }
+    Command command;
+    for (int i = 0; i < 8; i++) {
+        if (!queue.pop(command) || command.id != i) {
+            std::fprintf(stderr, "pop %d out of order\n", i);
+            return 1;
+        }
+    }
+    if (queue.pop(command)) {
+        std::fprintf(stderr, "pop succeeded while empty\n");
+        return 1;
+    }
+
+    // Commands posted from another thread arrive whole and in order.
+    constexpr int count = 1000000;
+    std::thread producer([&queue] {
+        for (int i = 0; i < count; i++) {
+            while (!queue.push({(uint32_t)i, i, (float)i})) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    int failures = 0;
+    for (int expected = 0; expected < count;) {
+        if (!queue.pop(command)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (command.offset != (uint32_t)expected || command.id != expected || command.value != (float)expected) {
+            failures++;
+        }
+        expected++;
+    }
+    producer.join();
+    if (failures > 0) {
+        std::fprintf(stderr, "%d commands arrived damaged or out of order\n", failures);
+        return 1;
+    }
+
+    // Commands posted from several threads at once all arrive whole, in the
+    // order each thread posted them.
+    constexpr int producerCount = 4;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < producerCount; p++) {
+        producers.emplace_back([&queue, p] {
+            for (int i = 0; i < count / producerCount; i++) {
+                while (!queue.push({(uint32_t)i, p, (float)i})) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    int next[producerCount] = {};
+    for (int received = 0; received < count / producerCount * producerCount;) {
+        if (!queue.pop(command)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (command.id < 0 || command.id >= producerCount) {
+            failures++;
+        } else {
+            if (command.offset != (uint32_t)next[command.id] || command.value != (float)next[command.id]) {
+                failures++;
+            }
+            next[command.id] = command.offset + 1;
+        }
+        received++;
+    }
+    for (auto& thread : producers) {
+        thread.join();
+    }
+    if (failures > 0) {
+        std::fprintf(stderr, "%d commands from several threads arrived damaged or out of order\n", failures);
+        return 1;
+    }
+    if (queue.pop(command)) {
+        std::fprintf(stderr, "pop succeeded after every command arrived\n");
+        return 1;
+    }
+    return 0;
+}
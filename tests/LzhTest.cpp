@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include "LzhDecoder.hpp"
+#include "LzhEncoder.hpp"
+
+using namespace AyMidi;
+
+namespace {
+
+    // Register dump like data, runs of slowly changing values with some
+    // noise, so that every code path of the encoder gets used.
+    std::vector<uint8_t> makeData(size_t size, uint32_t seed) {
+        std::vector<uint8_t> data(size);
+        uint8_t value = 0;
+        for (size_t i = 0; i < size; i++) {
+            seed = seed * 1664525 + 1013904223;
+            const uint32_t random = seed >> 8;
+            if (random % 16 == 0) {
+                value = random >> 8;
+            } else if (random % 64 == 1 && i >= 300) {
+                data[i] = data[i - 1 - (random >> 8) % 300];
+                continue;
+            }
+            data[i] = random % 8 == 0 ? (uint8_t)(random >> 16) : value;
+        }
+        return data;
+    }
+
+    bool roundTrip(const std::vector<uint8_t>& data) {
+        FILE* file = std::tmpfile();
+        if (file == nullptr) {
+            std::perror("tmpfile");
+            return false;
+        }
+        LzhEncoder encoder(file);
+        // Uneven pieces, the encoder must not depend on how input arrives.
+        for (size_t done = 0; done < data.size();) {
+            const size_t size = std::min<size_t>(data.size() - done, 1 + done % 7919);
+            encoder.write(data.data() + done, size);
+            done += size;
+        }
+        if (!encoder.finish()) {
+            std::fclose(file);
+            return false;
+        }
+        std::vector<uint8_t> packed(encoder.getCompressedSize());
+        std::rewind(file);
+        const bool read = std::fread(packed.data(), 1, packed.size(), file) == packed.size();
+        std::fclose(file);
+        if (!read) {
+            return false;
+        }
+        LzhDecoder decoder(packed.data(), packed.size(), data.size());
+        std::vector<uint8_t> unpacked(data.size());
+        return decoder.read(unpacked.data(), unpacked.size()) == unpacked.size() && !decoder.hasFailed()
+            && unpacked == data;
+    }
+}
+
+int main() {
+    const size_t sizes[] = {1, 100, 8192, 8193, 65536, 1000000};
+    for (size_t size : sizes) {
+        if (!roundTrip(makeData(size, size))) {
+            std::fprintf(stderr, "%zu bytes differ after packing\n", size);
+            return 1;
+        }
+    }
+    if (!roundTrip(std::vector<uint8_t>(300000, 0x55))) {
+        std::fprintf(stderr, "constant data differs after packing\n");
+        return 1;
+    }
+    return 0;
+}
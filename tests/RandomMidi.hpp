@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include "SynthEngine.hpp"
+
+namespace AyMidi {
+
+    // Reproducible stream of notes, controllers and drums over every
+    // channel, sent to one or more engines alike.
+    class RandomMidi {
+
+        private:
+            uint32_t seed;
+
+        public:
+            explicit RandomMidi(uint32_t seed) :
+                seed(seed)
+            {
+            }
+
+            uint32_t next(uint32_t range) {
+                seed = seed * 1664525 + 1013904223;
+                return (seed >> 8) % range;
+            }
+
+            // Fills a three byte message.
+            void message(uint8_t* message) {
+                static const uint8_t controllers[] = {1, 5, 7, 10, 65, 76, 77, 78, 79, 84, 102, 103, 104, 105,
+                    106, 107, 108, 109, 110, 111, 112, 113};
+                const uint8_t channel = next(16);
+                const uint32_t kind = next(100);
+                message[1] = next(128);
+                message[2] = next(128);
+                if (kind < 8) {
+                    message[0] = 0x99;
+                    message[1] = 30 + next(40);
+                } else if (kind < 40) {
+                    message[0] = 0x90 | channel;
+                    message[1] = 36 + next(48);
+                } else if (kind < 70) {
+                    message[0] = 0x80 | channel;
+                    message[1] = 36 + next(48);
+                } else if (kind < 88) {
+                    message[0] = 0xB0 | channel;
+                    message[1] = controllers[next(sizeof(controllers))];
+                } else if (kind < 94) {
+                    message[0] = 0xC0 | channel;
+                    message[1] = next(6);
+                } else {
+                    message[0] = 0xE0 | channel;
+                }
+            }
+    };
+}
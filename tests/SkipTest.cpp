@@ -0,0 +1,76 @@
+#include <cmath>
+#include <cstdio>
+#include "RandomMidi.hpp"
+#include "SynthEngine.hpp"
+
+using namespace AyMidi;
+
+static bool matches(const float* a, const float* b, uint32_t size, float tolerance) {
+    for (uint32_t i = 0; i < size; i++) {
+        if (std::fabs(a[i] - b[i]) > tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// One engine renders everything while the other skips parts of the same
+// input. Every block rendered by both after a skip must match, exactly
+// unless DC removal is on: its running sum rounds differently once the
+// skipping engine warmed it up again.
+static bool compare(bool removeDc, float tolerance) {
+    constexpr int blockSize = 1024;
+    SynthEngine rendered(44100, 2000000);
+    SynthEngine skipped(44100, 2000000);
+    rendered.enableRemoveDc(removeDc);
+    skipped.enableRemoveDc(removeDc);
+    RandomMidi midi(1);
+    static float left[2][blockSize * 8];
+    static float right[2][blockSize * 8];
+    long compared = 0;
+    for (int i = 0; i < 20000; i++) {
+        const uint32_t action = midi.next(100);
+        if (action < 2) {
+            const int chips = 1 + midi.next(SynthEngine::maxChips);
+            rendered.setChips(chips);
+            skipped.setChips(chips);
+        } else if (action < 3) {
+            const int rate = 25 + midi.next(276);
+            rendered.setUpdateRate(rate);
+            skipped.setUpdateRate(rate);
+        } else if (action < 4) {
+            const Quality quality = (Quality)midi.next(3);
+            rendered.setQuality(quality);
+            skipped.setQuality(quality);
+        } else if (action < 90) {
+            uint8_t message[3];
+            midi.message(message);
+            const uint32_t offset = midi.next(blockSize);
+            rendered.midiSend(message, offset);
+            skipped.midiSend(message, offset);
+        } else if (action < 94) {
+            const uint32_t size = 1 + midi.next(blockSize * 8);
+            rendered.process(left[0], right[0], size);
+            skipped.skip(size);
+        } else {
+            const uint32_t size = 1 + midi.next(blockSize);
+            rendered.process(left[0], right[0], size);
+            skipped.process(left[1], right[1], size);
+            if (!matches(left[0], left[1], size, tolerance) || !matches(right[0], right[1], size, tolerance)) {
+                std::fprintf(stderr, "output differs after %ld samples compared, step %d%s\n",
+                        compared, i, removeDc ? " with DC removal" : "");
+                return false;
+            }
+            compared += size;
+        }
+    }
+    std::printf("%ld samples compared%s\n", compared, removeDc ? " with DC removal" : "");
+    return true;
+}
+
+int main() {
+    if (!compare(false, 0.0f) || !compare(true, 1e-6f)) {
+        return 1;
+    }
+    return 0;
+}
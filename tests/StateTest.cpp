@@ -0,0 +1,79 @@
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include "RandomMidi.hpp"
+#include "SynthEngine.hpp"
+
+using namespace AyMidi;
+
+namespace {
+
+    constexpr int blockSize = 512;
+
+    // Plays the same random input into both engines, false when their
+    // output differs.
+    bool compare(SynthEngine& a, SynthEngine& b, uint32_t seed, int blocks) {
+        RandomMidi midi(seed);
+        float left[2][blockSize];
+        float right[2][blockSize];
+        for (int i = 0; i < blocks; i++) {
+            for (int events = midi.next(8); events > 0; events--) {
+                uint8_t message[3];
+                midi.message(message);
+                const uint32_t offset = midi.next(blockSize);
+                a.midiSend(message, offset);
+                b.midiSend(message, offset);
+            }
+            a.process(left[0], right[0], blockSize);
+            b.process(left[1], right[1], blockSize);
+            if (std::memcmp(left[0], left[1], sizeof(left[0])) != 0
+                    || std::memcmp(right[0], right[1], sizeof(right[0])) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+// An engine restored from a state must carry on exactly like the one it was
+// saved from, whatever it was doing before.
+int main() {
+    auto state = std::make_unique<SynthEngine::State>();
+    SynthEngine saved(44100, 2000000);
+    SynthEngine restored(44100, 1773400);
+    restored.setChips(3);
+    restored.setQuality(QUALITY_MASTERING);
+    saved.setChips(2);
+    float left[blockSize];
+    float right[blockSize];
+    for (int round = 0; round < 50; round++) {
+        RandomMidi midi(1000 + round);
+        for (int i = 0; i < 20; i++) {
+            for (int events = midi.next(8); events > 0; events--) {
+                uint8_t message[3];
+                midi.message(message);
+                saved.midiSend(message, midi.next(blockSize));
+            }
+            saved.process(left, right, blockSize);
+        }
+        uint8_t message[3];
+        midi.message(message);
+        saved.midiSend(message, midi.next(blockSize));
+        saved.save(*state);
+        if (!restored.restore(*state)) {
+            std::fprintf(stderr, "restore refused, round %d\n", round);
+            return 1;
+        }
+        if (!compare(saved, restored, round, 40)) {
+            std::fprintf(stderr, "output differs after restore, round %d\n", round);
+            return 1;
+        }
+    }
+
+    SynthEngine other(48000, 2000000);
+    if (other.restore(*state)) {
+        std::fprintf(stderr, "state restored at another sample rate\n");
+        return 1;
+    }
+    return 0;
+}
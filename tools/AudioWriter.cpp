@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "AudioWriter.hpp"
+
+namespace AyMidi {
+
+    static void putLittleEndian(uint8_t* data, uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            data[i] = value >> (8 * i);
+        }
+    }
+
+    AudioWriter::~AudioWriter() {
+        close();
+    }
+
+    bool AudioWriter::open(const std::string& path, Format format, int sampleRate) {
+        close();
+        this->format = format;
+        this->sampleRate = sampleRate;
+        frames = 0;
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            error = path + ": " + std::strerror(errno);
+            return false;
+        }
+        return format == RAW || writeHeader();
+    }
+
+    // WAVE_FORMAT_IEEE_FLOAT with a fact chunk. Sizes are patched on close.
+    bool AudioWriter::writeHeader() {
+        const uint32_t dataSize = frames * 2 * sizeof(float);
+        uint8_t header[58];
+        std::memcpy(header, "RIFF", 4);
+        putLittleEndian(header + 4, 50 + dataSize, 4);
+        std::memcpy(header + 8, "WAVEfmt ", 8);
+        putLittleEndian(header + 16, 18, 4);
+        putLittleEndian(header + 20, 3, 2);
+        putLittleEndian(header + 22, 2, 2);
+        putLittleEndian(header + 24, sampleRate, 4);
+        putLittleEndian(header + 28, sampleRate * 2 * sizeof(float), 4);
+        putLittleEndian(header + 32, 2 * sizeof(float), 2);
+        putLittleEndian(header + 34, 32, 2);
+        putLittleEndian(header + 36, 0, 2);
+        std::memcpy(header + 38, "fact", 4);
+        putLittleEndian(header + 42, 4, 4);
+        putLittleEndian(header + 46, frames, 4);
+        std::memcpy(header + 50, "data", 4);
+        putLittleEndian(header + 54, dataSize, 4);
+        if (std::fwrite(header, sizeof(header), 1, file) != 1) {
+            error = std::strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    bool AudioWriter::write(const float* left, const float* right, int count) {
+        float buffer[512];
+        while (count > 0) {
+            const int size = std::min(count, 256);
+            for (int i = 0; i < size; i++) {
+                uint32_t l;
+                uint32_t r;
+                std::memcpy(&l, &left[i], 4);
+                std::memcpy(&r, &right[i], 4);
+                putLittleEndian((uint8_t*)&buffer[2 * i], l, 4);
+                putLittleEndian((uint8_t*)&buffer[2 * i + 1], r, 4);
+            }
+            if (std::fwrite(buffer, sizeof(float), 2 * size, file) != (size_t)(2 * size)) {
+                error = std::strerror(errno);
+                return false;
+            }
+            frames += size;
+            left += size;
+            right += size;
+            count -= size;
+        }
+        return true;
+    }
+
+    bool AudioWriter::close() {
+        if (file == nullptr) {
+            return true;
+        }
+        bool ok = true;
+        if (format == WAV) {
+            ok = std::fseek(file, 0, SEEK_SET) == 0 && writeHeader();
+        }
+        if (std::fclose(file) != 0 && ok) {
+            error = std::strerror(errno);
+            ok = false;
+        }
+        file = nullptr;
+        return ok;
+    }
+
+    uint64_t AudioWriter::getFrames() const {
+        return frames;
+    }
+
+    const std::string& AudioWriter::getError() const {
+        return error;
+    }
+}
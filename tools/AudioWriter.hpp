@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace AyMidi {
+
+    // Writes interleaved stereo 32-bit float samples, either as a WAV file
+    // or headerless.
+    class AudioWriter {
+
+        public:
+            enum Format {
+                WAV,
+                RAW
+            };
+
+        private:
+            FILE* file = nullptr;
+            Format format = WAV;
+            int sampleRate = 0;
+            uint64_t frames = 0;
+            std::string error;
+
+            bool writeHeader();
+
+        public:
+            ~AudioWriter();
+            bool open(const std::string& path, Format format, int sampleRate);
+            bool write(const float* left, const float* right, int count);
+            bool close();
+            uint64_t getFrames() const;
+            const std::string& getError() const;
+    };
+}
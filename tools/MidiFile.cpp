@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include "MidiFile.hpp"
+
+namespace AyMidi {
+
+    static uint32_t readBigEndian(const uint8_t* data, int bytes) {
+        uint32_t value = 0;
+        for (int i = 0; i < bytes; i++) {
+            value = value << 8 | data[i];
+        }
+        return value;
+    }
+
+    static bool readVariableLength(const uint8_t*& data, const uint8_t* end, uint32_t& value) {
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            if (data == end) {
+                return false;
+            }
+            const uint8_t byte = *data++;
+            value = value << 7 | (byte & 0x7F);
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool MidiFile::fail(const std::string& message) {
+        error = message;
+        events.clear();
+        return false;
+    }
+
+    bool MidiFile::load(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return fail("can't open " + path);
+        }
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return parse(data.data(), data.size());
+    }
+
+    bool MidiFile::parseTrack(const uint8_t* data, size_t size, int track, std::vector<TrackEvent>& trackEvents) {
+        const uint8_t* end = data + size;
+        uint64_t tick = 0;
+        uint8_t status = 0;
+        int order = 0;
+        while (data < end) {
+            uint32_t delta;
+            if (!readVariableLength(data, end, delta) || data == end) {
+                return fail("truncated track " + std::to_string(track));
+            }
+            tick += delta;
+            TrackEvent event = {tick, track, order++, false, 0, {0, 0, 0}};
+            if (*data == 0xFF) {
+                if (end - data < 2) {
+                    return fail("truncated meta event");
+                }
+                const uint8_t type = data[1];
+                data += 2;
+                uint32_t length;
+                if (!readVariableLength(data, end, length) || (size_t)(end - data) < length) {
+                    return fail("truncated meta event");
+                }
+                if (type == 0x2F) {
+                    return true;
+                }
+                if (type == 0x51 && length == 3) {
+                    event.tempo = true;
+                    event.microseconds = readBigEndian(data, 3);
+                    trackEvents.push_back(event);
+                }
+                data += length;
+                continue;
+            }
+            if (*data == 0xF0 || *data == 0xF7) {
+                data++;
+                uint32_t length;
+                if (!readVariableLength(data, end, length) || (size_t)(end - data) < length) {
+                    return fail("truncated sysex event");
+                }
+                data += length;
+                status = 0;
+                continue;
+            }
+            if (*data & 0x80) {
+                status = *data++;
+            } else if (status == 0) {
+                return fail("data byte without status in track " + std::to_string(track));
+            }
+            const uint8_t type = status & 0xF0;
+            const int length = type == 0xC0 || type == 0xD0 ? 1 : 2;
+            if (end - data < length) {
+                return fail("truncated channel message");
+            }
+            event.data[0] = status;
+            event.data[1] = data[0] & 0x7F;
+            event.data[2] = length == 2 ? data[1] & 0x7F : 0;
+            data += length;
+            // Note on with null velocity is a note off.
+            if (type == 0x90 && event.data[2] == 0) {
+                event.data[0] = 0x80 | (status & 0x0F);
+            }
+            trackEvents.push_back(event);
+        }
+        return true;
+    }
+
+    bool MidiFile::parse(const uint8_t* data, size_t size) {
+        events.clear();
+        error.clear();
+        const uint8_t* end = data + size;
+        if (size < 14 || std::string((const char*)data, 4) != "MThd" || readBigEndian(data + 4, 4) < 6) {
+            return fail("not a standard MIDI file");
+        }
+        format = readBigEndian(data + 8, 2);
+        tracks = readBigEndian(data + 10, 2);
+        const uint16_t division = readBigEndian(data + 12, 2);
+        if (format > 1) {
+            return fail("unsupported MIDI file format " + std::to_string(format));
+        }
+        const uint32_t headerLength = readBigEndian(data + 4, 4);
+        if (headerLength > size - 8) {
+            return fail("truncated header");
+        }
+        data += 8 + headerLength;
+
+        std::vector<TrackEvent> trackEvents;
+        int track = 0;
+        while (end - data >= 8 && track < tracks) {
+            const uint32_t length = readBigEndian(data + 4, 4);
+            if ((size_t)(end - data - 8) < length) {
+                return fail("truncated chunk");
+            }
+            if (std::string((const char*)data, 4) == "MTrk") {
+                if (!parseTrack(data + 8, length, track, trackEvents)) {
+                    return false;
+                }
+                track++;
+            }
+            data += 8 + length;
+        }
+
+        // Tempo changes apply to every track, so they go first at equal ticks.
+        std::stable_sort(trackEvents.begin(), trackEvents.end(), [](const TrackEvent& a, const TrackEvent& b) {
+            if (a.tick != b.tick) {
+                return a.tick < b.tick;
+            }
+            if (a.tempo != b.tempo) {
+                return a.tempo;
+            }
+            return a.track != b.track ? a.track < b.track : a.order < b.order;
+        });
+
+        double secondsPerTick;
+        const bool smpte = division & 0x8000;
+        if (smpte) {
+            const int framesPerSecond = -(int8_t)(division >> 8);
+            const int ticksPerFrame = division & 0xFF;
+            if (framesPerSecond <= 0 || ticksPerFrame == 0) {
+                return fail("invalid time division");
+            }
+            secondsPerTick = 1.0 / (framesPerSecond * ticksPerFrame);
+        } else {
+            if (division == 0) {
+                return fail("invalid time division");
+            }
+            secondsPerTick = 0.5 / division;
+        }
+
+        uint64_t lastTick = 0;
+        double time = 0.0;
+        for (const auto& event : trackEvents) {
+            time += (event.tick - lastTick) * secondsPerTick;
+            lastTick = event.tick;
+            if (event.tempo) {
+                if (!smpte) {
+                    secondsPerTick = event.microseconds * 1e-6 / division;
+                }
+                continue;
+            }
+            events.push_back({time, {event.data[0], event.data[1], event.data[2]}});
+        }
+        return true;
+    }
+
+    const std::vector<MidiFile::Event>& MidiFile::getEvents() const {
+        return events;
+    }
+
+    double MidiFile::getDuration() const {
+        return events.empty() ? 0.0 : events.back().time;
+    }
+
+    int MidiFile::getFormat() const {
+        return format;
+    }
+
+    int MidiFile::getTracks() const {
+        return tracks;
+    }
+
+    const std::string& MidiFile::getError() const {
+        return error;
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace AyMidi {
+
+    // Standard MIDI File reader. Tracks are merged into a single list of
+    // channel messages sorted by time.
+    class MidiFile {
+
+        public:
+            struct Event {
+                double time; // In seconds
+                uint8_t data[3];
+            };
+
+        private:
+            struct TrackEvent {
+                uint64_t tick;
+                int track;
+                int order;
+                bool tempo;
+                uint32_t microseconds;
+                uint8_t data[3];
+            };
+
+            std::vector<Event> events;
+            std::string error;
+            int format = 0;
+            int tracks = 0;
+
+            bool fail(const std::string& message);
+            bool parseTrack(const uint8_t* data, size_t size, int track, std::vector<TrackEvent>& trackEvents);
+
+        public:
+            bool load(const std::string& path);
+            bool parse(const uint8_t* data, size_t size);
+            const std::vector<Event>& getEvents() const;
+            double getDuration() const;
+            int getFormat() const;
+            int getTracks() const;
+            const std::string& getError() const;
+    };
+}
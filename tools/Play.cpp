@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AudioWriter.hpp"
+#include "DumpPlayer.hpp"
+#include "WorkerPool.hpp"
+
+using namespace AyMidi;
+
+namespace {
+
+    constexpr int blockSize = 256;
+
+    struct Options {
+        int sampleRate = 44100;
+        Quality quality = QUALITY_NORMAL;
+        AudioWriter::Format format = AudioWriter::WAV;
+        double tail = 1.0;
+        int jobs = 0;
+        std::string outputDir;
+    };
+
+    std::mutex outputMutex;
+
+    void report(const char* format, const std::string& path, const std::string& message) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::fprintf(stderr, format, path.c_str(), message.c_str());
+    }
+
+    std::string outputPath(const std::string& input, const Options& options) {
+        std::string name = input;
+        if (!options.outputDir.empty()) {
+            const size_t slash = name.find_last_of('/');
+            if (slash != std::string::npos) {
+                name = name.substr(slash + 1);
+            }
+            name = options.outputDir + "/" + name;
+        }
+        const size_t dot = name.find_last_of('.');
+        if (dot != std::string::npos && dot > name.find_last_of('/') + 1) {
+            name = name.substr(0, dot);
+        }
+        return name + (options.format == AudioWriter::WAV ? ".wav" : ".raw");
+    }
+
+    // Renders as fast as possible until the dump ends, then until the chips
+    // fall idle or the tail ends.
+    bool play(const std::string& input, const Options& options) {
+        auto player = std::make_unique<DumpPlayer>(options.sampleRate);
+        player->setQuality(options.quality);
+        if (!player->load(input)) {
+            report("%s: %s\n", input, player->getError());
+            return false;
+        }
+        const std::string output = outputPath(input, options);
+        AudioWriter writer;
+        if (!writer.open(output, options.format, options.sampleRate)) {
+            report("%s: %s\n", input, writer.getError());
+            return false;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        float left[blockSize];
+        float right[blockSize];
+        uint64_t frame = 0;
+        uint64_t end = 0;
+        while (!player->isFinished() || (frame < end && !player->isIdle())) {
+            player->process(left, right, blockSize);
+            if (!writer.write(left, right, blockSize)) {
+                report("%s: %s\n", output, writer.getError());
+                return false;
+            }
+            frame += blockSize;
+            if (!player->isFinished()) {
+                end = frame + options.tail * options.sampleRate;
+            }
+        }
+        if (!writer.close()) {
+            report("%s: %s\n", output, writer.getError());
+            return false;
+        }
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        char message[64];
+        std::snprintf(message, sizeof(message), "%llu frames, %.0fx realtime",
+                (unsigned long long)frame, frame / (double)options.sampleRate / std::max(elapsed, 1e-9));
+        report("%s: %s\n", output, message);
+        return true;
+    }
+
+    void usage(const char* name) {
+        std::fprintf(stderr,
+                "Usage: %s [options] file.ym|file.vgm|file.psg...\n"
+                "  -o dir        Output directory, defaults to the input's\n"
+                "  -r rate       Sample rate (44100)\n"
+                "  -q quality    draft, normal or mastering (normal)\n"
+                "  -t seconds    Maximum tail after the end of the dump (1)\n"
+                "  -j jobs       Files rendered in parallel (all cores)\n"
+                "  --raw         Headerless interleaved float output\n",
+                name);
+        std::exit(1);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--raw") {
+            options.format = AudioWriter::RAW;
+        } else if (arg == "-o" && hasValue) {
+            options.outputDir = argv[++i];
+        } else if (arg == "-r" && hasValue) {
+            options.sampleRate = std::atoi(argv[++i]);
+        } else if (arg == "-q" && hasValue) {
+            const std::string quality = argv[++i];
+            if (quality == "draft") {
+                options.quality = QUALITY_DRAFT;
+            } else if (quality == "normal") {
+                options.quality = QUALITY_NORMAL;
+            } else if (quality == "mastering") {
+                options.quality = QUALITY_MASTERING;
+            } else {
+                usage(argv[0]);
+            }
+        } else if (arg == "-t" && hasValue) {
+            options.tail = std::atof(argv[++i]);
+        } else if (arg == "-j" && hasValue) {
+            options.jobs = std::atoi(argv[++i]);
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            usage(argv[0]);
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty() || options.sampleRate <= 0 || options.tail < 0) {
+        usage(argv[0]);
+    }
+    // Files are written at the same time, each input needs its own output.
+    std::set<std::string> outputs;
+    for (const auto& input : inputs) {
+        if (!outputs.insert(outputPath(input, options)).second) {
+            std::fprintf(stderr, "%s: same output file as another input\n", input.c_str());
+            return 1;
+        }
+    }
+
+    int jobs = options.jobs > 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    jobs = std::min<int>(jobs, inputs.size());
+    std::atomic<int> failed{0};
+    auto playFile = [&](int index) {
+        if (!play(inputs[index], options)) {
+            failed++;
+        }
+    };
+    // The calling thread takes part, so one less worker is needed.
+    WorkerPool pool(jobs - 1);
+    pool.run(inputs.size(), playFile);
+    return failed > 0 ? 1 : 0;
+}
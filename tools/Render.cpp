@@ -0,0 +1,423 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AudioWriter.hpp"
+#include "MidiFile.hpp"
+#include "RegisterWriter.hpp"
+#include "SynthEngine.hpp"
+#include "WorkerPool.hpp"
+
+using namespace AyMidi;
+
+namespace {
+
+    constexpr int blockSize = 256;
+    constexpr uint64_t noEnd = std::numeric_limits<uint64_t>::max();
+
+    struct Options {
+        int sampleRate = 44100;
+        int clockRate = 2000000;
+        int updateRate = 50;
+        int chips = 1;
+        Emul emul = YM2149;
+        Quality quality = QUALITY_NORMAL;
+        AudioWriter::Format format = AudioWriter::WAV;
+        bool dump = false;
+        RegisterWriter::Format dumpFormat = RegisterWriter::YM;
+        double tail = 10.0;
+        double segment = 0.0;
+        int jobs = 0;
+        std::string outputDir;
+        const DrumKit* drumKit = nullptr;
+    };
+
+    std::mutex outputMutex;
+
+    void report(const char* format, const std::string& path, const std::string& message) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::fprintf(stderr, format, path.c_str(), message.c_str());
+    }
+
+    std::string outputPath(const std::string& input, const Options& options, const std::string& extension) {
+        std::string name = input;
+        if (!options.outputDir.empty()) {
+            const size_t slash = name.find_last_of('/');
+            if (slash != std::string::npos) {
+                name = name.substr(slash + 1);
+            }
+            name = options.outputDir + "/" + name;
+        }
+        const size_t dot = name.find_last_of('.');
+        if (dot != std::string::npos && dot > name.find_last_of('/') + 1) {
+            name = name.substr(0, dot);
+        }
+        return name + extension;
+    }
+
+    // Engines only render their chips on worker threads of their own when
+    // nothing else runs in parallel, segments and files already use the cores.
+    std::unique_ptr<SynthEngine> makeEngine(const Options& options, bool parallel = false) {
+        auto engine = std::make_unique<SynthEngine>(options.sampleRate, options.clockRate, parallel);
+        engine->setGain(1.0f);
+        engine->setChips(options.chips);
+        engine->setEmul(options.emul);
+        engine->setQuality(options.quality);
+        engine->setUpdateRate(options.updateRate);
+        engine->setDrumKit(options.drumKit);
+        return engine;
+    }
+
+    // Position in the file's events, at a block boundary.
+    struct Cursor {
+        uint64_t frame = 0;
+        size_t next = 0;
+    };
+
+    // Hands the events of the block at the cursor to the engine at their
+    // sample offsets like the plugin does with a host buffer.
+    void sendEvents(SynthEngine& engine, const std::vector<MidiFile::Event>& events, Cursor& cursor, int count,
+            int sampleRate, std::vector<SynthEngine::MidiEvent>& batch) {
+        batch.clear();
+        uint64_t eventFrame;
+        while (cursor.next < events.size() && (eventFrame = events[cursor.next].time * sampleRate + 0.5) < cursor.frame + count) {
+            const uint8_t* data = events[cursor.next++].data;
+            batch.push_back({(uint32_t)(eventFrame - std::min(eventFrame, cursor.frame)), {data[0], data[1], data[2]}});
+        }
+        engine.midiSend(batch.data(), batch.size());
+    }
+
+    // Renders blocks from the cursor up to endFrame, or with no end until the
+    // events are done and then until the chips fall idle or the tail ends.
+    // Each block and the registers logged during it go to emit.
+    template <typename Emit>
+    bool renderFrames(SynthEngine& engine, RegisterLog& registerLog, const std::vector<MidiFile::Event>& events,
+            const Options& options, Cursor& cursor, uint64_t endFrame, Emit& emit) {
+        float left[blockSize];
+        float right[blockSize];
+        std::vector<SynthEngine::MidiEvent> batch;
+        auto renderBlock = [&](int count) {
+            sendEvents(engine, events, cursor, count, options.sampleRate, batch);
+            engine.process(left, right, count);
+            cursor.frame += count;
+            return emit(left, right, count, registerLog);
+        };
+
+        if (endFrame != noEnd) {
+            while (cursor.frame < endFrame) {
+                if (!renderBlock(blockSize)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        while (cursor.next < events.size()) {
+            if (!renderBlock(blockSize)) {
+                return false;
+            }
+        }
+        const uint64_t end = cursor.frame + options.tail * options.sampleRate;
+        while (cursor.frame < end && !engine.isIdle()) {
+            if (!renderBlock(std::min<uint64_t>(blockSize, end - cursor.frame))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Audio and registers of a segment, kept until the ones before it are
+    // written.
+    struct Segment {
+        Cursor start;
+        std::unique_ptr<SynthEngine::State> state;
+        std::vector<float> left;
+        std::vector<float> right;
+        std::vector<RegisterFrame> registers;
+        bool failed = false;
+    };
+
+    // Fast-forwards one engine through the events, saving its state at the
+    // start of every segment but the first. Only the block before each start
+    // is warmed up, which is all the next process call needs.
+    std::vector<Segment> chaseSegments(const std::vector<MidiFile::Event>& events, const Options& options) {
+        const uint64_t length = std::max<uint64_t>(options.segment * options.sampleRate / blockSize, 1) * blockSize;
+        std::vector<Segment> segments(1);
+        auto engine = makeEngine(options);
+        std::vector<SynthEngine::MidiEvent> batch;
+        Cursor cursor;
+        while (cursor.next < events.size()) {
+            if (cursor.frame > 0 && cursor.frame % length == 0) {
+                segments.emplace_back();
+                segments.back().start = cursor;
+                segments.back().state = std::make_unique<SynthEngine::State>();
+                engine->save(*segments.back().state);
+            }
+            sendEvents(*engine, events, cursor, blockSize, options.sampleRate, batch);
+            cursor.frame += blockSize;
+            engine->skip(blockSize, cursor.frame % length == 0);
+        }
+        return segments;
+    }
+
+    // Renders the file once through, or in segments rendered in parallel
+    // from the chased states and written in order, which gives the same
+    // samples and registers.
+    bool render(const std::string& input, const Options& options, WorkerPool* pool, bool parallelChips = false) {
+        MidiFile midiFile;
+        if (!midiFile.load(input)) {
+            report("%s: %s\n", input, midiFile.getError());
+            return false;
+        }
+        const std::string output = outputPath(input, options, options.format == AudioWriter::WAV ? ".wav" : ".raw");
+        AudioWriter writer;
+        if (!writer.open(output, options.format, options.sampleRate)) {
+            report("%s: %s\n", input, writer.getError());
+            return false;
+        }
+        RegisterWriter registerWriter;
+        const std::string dumpOutput = outputPath(input, options, options.dumpFormat == RegisterWriter::YM ? ".ym" : ".vgm");
+        if (options.dump) {
+            if (!registerWriter.open(dumpOutput, options.dumpFormat, options.clockRate, options.updateRate, options.emul)) {
+                report("%s: %s\n", input, registerWriter.getError());
+                return false;
+            }
+        }
+
+        const auto& events = midiFile.getEvents();
+        uint64_t frames = 0;
+        auto writeAudio = [&](const float* left, const float* right, int count) {
+            if (!writer.write(left, right, count)) {
+                report("%s: %s\n", output, writer.getError());
+                return false;
+            }
+            frames += count;
+            return true;
+        };
+        auto writeRegisters = [&](const RegisterFrame& registers) {
+            if (!registerWriter.write(registers)) {
+                report("%s: %s\n", dumpOutput, registerWriter.getError());
+                return false;
+            }
+            return true;
+        };
+        auto write = [&](const float* left, const float* right, int count, RegisterLog& registerLog) {
+            if (!writeAudio(left, right, count)) {
+                return false;
+            }
+            RegisterFrame registers;
+            while (registerLog.pop(registers)) {
+                if (!writeRegisters(registers)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        if (pool == nullptr) {
+            auto engine = makeEngine(options, parallelChips);
+            RegisterLog registerLog;
+            if (options.dump) {
+                engine->setRegisterLog(&registerLog);
+            }
+            Cursor cursor;
+            if (!renderFrames(*engine, registerLog, events, options, cursor, noEnd, write)) {
+                return false;
+            }
+        } else {
+            std::vector<Segment> segments = chaseSegments(events, options);
+            auto renderSegment = [&](int index) {
+                Segment& segment = segments[index];
+                auto engine = makeEngine(options);
+                if (segment.state != nullptr && !engine->restore(*segment.state)) {
+                    segment.failed = true;
+                    return;
+                }
+                segment.state.reset();
+                auto keep = [&segment](const float* left, const float* right, int count, RegisterLog& registerLog) {
+                    segment.left.insert(segment.left.end(), left, left + count);
+                    segment.right.insert(segment.right.end(), right, right + count);
+                    RegisterFrame registers;
+                    while (registerLog.pop(registers)) {
+                        segment.registers.push_back(registers);
+                    }
+                    return true;
+                };
+                RegisterLog registerLog;
+                if (options.dump) {
+                    engine->setRegisterLog(&registerLog);
+                }
+                Cursor cursor = segment.start;
+                const uint64_t endFrame = index + 1 < (int)segments.size() ? segments[index + 1].start.frame : noEnd;
+                if (endFrame != noEnd) {
+                    segment.left.reserve(endFrame - cursor.frame);
+                    segment.right.reserve(endFrame - cursor.frame);
+                }
+                renderFrames(*engine, registerLog, events, options, cursor, endFrame, keep);
+            };
+            // In waves of one segment per thread, which bounds the memory
+            // held by rendered segments.
+            const int wave = pool->getThreadCount() + 1;
+            for (size_t first = 0; first < segments.size(); first += wave) {
+                const int count = std::min<size_t>(wave, segments.size() - first);
+                auto renderWave = [&](int index) {
+                    renderSegment(first + index);
+                };
+                pool->run(count, renderWave);
+                for (int i = 0; i < count; i++) {
+                    Segment& segment = segments[first + i];
+                    if (segment.failed) {
+                        report("%s: %s\n", input, "cannot restore the engine state");
+                        return false;
+                    }
+                    if (!writeAudio(segment.left.data(), segment.right.data(), segment.left.size())) {
+                        return false;
+                    }
+                    for (const auto& registers : segment.registers) {
+                        if (!writeRegisters(registers)) {
+                            return false;
+                        }
+                    }
+                    segment = Segment();
+                }
+            }
+        }
+
+        if (!writer.close()) {
+            report("%s: %s\n", output, writer.getError());
+            return false;
+        }
+        if (!registerWriter.close()) {
+            report("%s: %s\n", dumpOutput, registerWriter.getError());
+            return false;
+        }
+        report("%s: %s\n", output, std::to_string(frames) + " frames");
+        return true;
+    }
+
+    void usage(const char* name) {
+        std::fprintf(stderr,
+                "Usage: %s [options] file.mid...\n"
+                "  -o dir        Output directory, defaults to the input's\n"
+                "  -r rate       Sample rate (44100)\n"
+                "  -k clock      Chip clock rate (2000000)\n"
+                "  -u rate       Update rate (50)\n"
+                "  -c chips      Number of chips (1)\n"
+                "  -e ay|ym      Chip emulation (ym)\n"
+                "  -q quality    draft, normal or mastering (normal)\n"
+                "  -t seconds    Maximum tail after the last event (10)\n"
+                "  -j jobs       Files rendered in parallel (all cores)\n"
+                "  -s seconds    Split each file in segments of this length, rendered\n"
+                "                in parallel instead of the files (off)\n"
+                "  --drums dir   Digidrum samples as <key>.wav files (built-in kit)\n"
+                "  --raw         Headerless interleaved float output\n"
+                "  --dump ym|vgm Also write the chip registers, one frame per update\n",
+                name);
+        std::exit(1);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    std::vector<std::string> inputs;
+    DrumKit drumKit;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--raw") {
+            options.format = AudioWriter::RAW;
+        } else if (arg == "--drums" && hasValue) {
+            if (!drumKit.load(argv[++i])) {
+                std::fprintf(stderr, "%s\n", drumKit.getError().c_str());
+                return 1;
+            }
+            options.drumKit = &drumKit;
+        } else if (arg == "--dump" && hasValue) {
+            const std::string format = argv[++i];
+            if (format != "ym" && format != "vgm") {
+                usage(argv[0]);
+            }
+            options.dump = true;
+            options.dumpFormat = format == "ym" ? RegisterWriter::YM : RegisterWriter::VGM;
+        } else if (arg == "-o" && hasValue) {
+            options.outputDir = argv[++i];
+        } else if (arg == "-r" && hasValue) {
+            options.sampleRate = std::atoi(argv[++i]);
+        } else if (arg == "-k" && hasValue) {
+            options.clockRate = std::atoi(argv[++i]);
+        } else if (arg == "-u" && hasValue) {
+            options.updateRate = std::atoi(argv[++i]);
+        } else if (arg == "-c" && hasValue) {
+            options.chips = std::atoi(argv[++i]);
+        } else if (arg == "-e" && hasValue) {
+            const std::string emul = argv[++i];
+            if (emul != "ay" && emul != "ym") {
+                usage(argv[0]);
+            }
+            options.emul = emul == "ay" ? AY8910 : YM2149;
+        } else if (arg == "-q" && hasValue) {
+            const std::string quality = argv[++i];
+            if (quality == "draft") {
+                options.quality = QUALITY_DRAFT;
+            } else if (quality == "normal") {
+                options.quality = QUALITY_NORMAL;
+            } else if (quality == "mastering") {
+                options.quality = QUALITY_MASTERING;
+            } else {
+                usage(argv[0]);
+            }
+        } else if (arg == "-t" && hasValue) {
+            options.tail = std::atof(argv[++i]);
+        } else if (arg == "-s" && hasValue) {
+            options.segment = std::atof(argv[++i]);
+        } else if (arg == "-j" && hasValue) {
+            options.jobs = std::atoi(argv[++i]);
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            usage(argv[0]);
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty() || options.sampleRate <= 0 || options.clockRate <= 0 || options.updateRate <= 0
+            || options.chips < 1 || options.chips > SynthEngine::maxChips || options.tail < 0 || options.segment < 0) {
+        usage(argv[0]);
+    }
+    // Files are written at the same time, each input needs its own outputs.
+    std::set<std::string> outputs;
+    for (const auto& input : inputs) {
+        if (!outputs.insert(outputPath(input, options, "")).second) {
+            std::fprintf(stderr, "%s: same output file as another input\n", input.c_str());
+            return 1;
+        }
+    }
+
+    int jobs = options.jobs > 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    if (options.segment > 0) {
+        // The calling thread takes part, so one less worker is needed.
+        WorkerPool pool(jobs - 1);
+        int failed = 0;
+        for (const auto& input : inputs) {
+            if (!render(input, options, &pool)) {
+                failed++;
+            }
+        }
+        return failed > 0 ? 1 : 0;
+    }
+    jobs = std::min<int>(jobs, inputs.size());
+    std::atomic<int> failed{0};
+    auto renderFile = [&](int index) {
+        if (!render(inputs[index], options, nullptr, jobs == 1)) {
+            failed++;
+        }
+    };
+    WorkerPool pool(jobs - 1);
+    pool.run(inputs.size(), renderFile);
+    return failed > 0 ? 1 : 0;
+}